@@ -42,11 +42,14 @@
 #include <ZW_uart_api.h>
 
 #include <misc.h>
+#include <ZW_tx_mutex.h>
+#include <string.h>
 #ifdef BOOTLOADER_ENABLED
 #include <ota_util.h>
 #include <CommandClassFirmwareUpdate.h>
 #endif
 #include <nvm_util.h>
+#include <s2_keystore.h>
 
 /*IO control*/
 #include <io_zdp03a.h>
@@ -71,6 +74,8 @@
 #include <CommandClassSupervision.h>
 #include <CommandClassMultiChan.h>
 #include <CommandClassMultiChanAssociation.h>
+#include <ZW_TransportMulticast.h>
+#include <ZW_TransportSecProtocol.h>
 
 
 /****************************************************************************/
@@ -102,6 +107,93 @@
 #define ZW_DEBUG_APP_SEND_NL()
 #endif
 
+/**
+ * Feature profile, chosen in config_app.h. The default full profile builds
+ * every optional feature. APP_PROFILE_LEAN builds a plain three relay
+ * switch: Binary Switch, Switch All, Basic and the key control groups.
+ * APP_PROFILE_CUSTOM builds only the APP_FEATURE_* flags the configuration
+ * defines itself.
+ *
+ * An APP_FEATURE_* flag takes its command classes in or out of the NIF,
+ * the AGI lifeline, the dispatcher and Version together with their state,
+ * configuration parameters and unsolicited reports. Their NVM fields stay
+ * reserved so the NVM layout does not depend on the profile:
+ * - APP_FEATURE_CENTRAL_SCENE: Central Scene notifications from the keys.
+ * - APP_FEATURE_SCENES: Scene Activation and Scene Actuator Configuration.
+ * - APP_FEATURE_METER: Meter reports and configuration parameters 7 to 9.
+ *   The full profile only builds it when config_app.h gives the meter a
+ *   power source, METER_SAMPLE_POWER() or METER_NOMINAL_POWER.
+ * - APP_FEATURE_CONFIGURATION: Configuration. Without it the parameters
+ *   keep their defaults and their names and descriptions are not linked.
+ * - APP_FEATURE_PROPRIETARY: the Manufacturer Proprietary diagnostics
+ *   command, the only way to read the crash record, the link statistics
+ *   and the APP_DIAGNOSTICS counters.
+ * - APP_FEATURE_CRASH_RING: crash records of this run and the previous one.
+ * - APP_FEATURE_LINK_STATS: link statistics per peer and link alerts on
+ *   the lifeline.
+ *
+ * Tracing (ZW_DEBUG_APP), diagnostics (APP_DIAGNOSTICS, and
+ * APP_DIAGNOSTICS_LAB for lab builds), firmware update and OTA host mode
+ * (BOOTLOADER_ENABLED) and the factory mode (APP_FACTORY_MODE) keep their
+ * own flags in every profile. Diagnostics need APP_FEATURE_PROPRIETARY.
+ */
+#if !defined(APP_PROFILE_LEAN) && !defined(APP_PROFILE_CUSTOM)
+#define APP_FEATURE_CENTRAL_SCENE
+#define APP_FEATURE_SCENES
+#define APP_FEATURE_CONFIGURATION
+#define APP_FEATURE_PROPRIETARY
+#define APP_FEATURE_CRASH_RING
+#define APP_FEATURE_LINK_STATS
+#if defined(METER_SAMPLE_POWER) || defined(METER_NOMINAL_POWER)
+#define APP_FEATURE_METER
+#endif
+#endif
+
+#if !defined(APP_FEATURE_PROPRIETARY) && \
+    (defined(APP_FEATURE_CRASH_RING) || defined(APP_FEATURE_LINK_STATS) || defined(APP_DIAGNOSTICS))
+#error "APP_FEATURE_CRASH_RING, APP_FEATURE_LINK_STATS and APP_DIAGNOSTICS need APP_FEATURE_PROPRIETARY"
+#endif
+
+/**
+ * @def DIAG_FRAME_BEGIN()
+ * Marks the start of command class dispatch.
+ * @def DIAG_FRAME_END(pFrame, len)
+ * Counts a dispatched frame and its handler time for its class, and keeps
+ * the frame if it is the slowest so far.
+ * @def DIAG_APP_EVENT(state)
+ * Counts an AppStateManager event received in the given state.
+ * @def DIAG_POLL_BEGIN()
+ * Marks the start of an ApplicationPoll iteration.
+ * @def DIAG_POLL_END()
+ * Marks the end of an ApplicationPoll iteration.
+ * @def DIAG_OTA_WRITE(len)
+ * Counts an OTA fragment of len bytes.
+ *
+ * All of them compile to nothing unless APP_DIAGNOSTICS is defined.
+ */
+#ifdef APP_DIAGNOSTICS
+#ifndef DIAG_CLOCK
+/**
+ * Time source of the hot-path counters. Defaults to the 10 ms tick. A board
+ * or host build can map it to a free running hardware counter.
+ */
+#define DIAG_CLOCK() getTickTime()
+#endif
+#define DIAG_FRAME_BEGIN() DiagFrameBegin()
+#define DIAG_FRAME_END(pFrame, len) DiagFrameEnd(pFrame, len)
+#define DIAG_APP_EVENT(state) DiagAppEvent(state)
+#define DIAG_POLL_BEGIN() DiagPollBegin()
+#define DIAG_POLL_END() DiagPollEnd()
+#define DIAG_OTA_WRITE(len) DiagOtaWrite(len)
+#else
+#define DIAG_FRAME_BEGIN()
+#define DIAG_FRAME_END(pFrame, len)
+#define DIAG_APP_EVENT(state)
+#define DIAG_POLL_BEGIN()
+#define DIAG_POLL_END()
+#define DIAG_OTA_WRITE(len)
+#endif
+
 
 
 /**
@@ -111,7 +203,6 @@ typedef enum _EVENT_APP_
 {
   EVENT_EMPTY = DEFINE_EVENT_APP_NBR,
   EVENT_APP_INIT,
-  EVENT_APP_REFRESH_MMI,
   EVENT_APP_OTA_HOST_WRITE_DONE,
   EVENT_APP_OTA_HOST_STATUS,
 } EVENT_APP;
@@ -127,1181 +218,5625 @@ typedef enum _STATE_APP_
   STATE_APP_IDLE,
   STATE_APP_LEARN_MODE,
   STATE_APP_WATCHDOG_RESET,
-  STATE_APP_OTA,
-  STATE_APP_OTA_HOST
+  STATE_APP_OTA_HOST,
+  STATE_APP_FACTORY
 } STATE_APP;
 
 
-/****************************************************************************/
-/*                              PRIVATE DATA                                */
-/****************************************************************************/
+/**
+ * Timer handle value meaning no timer is running.
+ */
+#define APP_TIMER_NONE 0xFF
 
+#ifdef APP_FACTORY_MODE
 /**
- * Unsecure node information list.
- * Be sure Command classes are not duplicated in both lists.
- * CHANGE THIS - Add all supported non-secure command classes here
- **/
-static code BYTE cmdClassListNonSecureNotIncluded[] =
-{
-  COMMAND_CLASS_ZWAVEPLUS_INFO,
-  COMMAND_CLASS_SWITCH_BINARY,
-  COMMAND_CLASS_SWITCH_ALL,
-  COMMAND_CLASS_ASSOCIATION,
-  COMMAND_CLASS_MULTI_CHANNEL_ASSOCIATION_V2,
-  COMMAND_CLASS_ASSOCIATION_GRP_INFO,
-  COMMAND_CLASS_TRANSPORT_SERVICE_V2,
-  COMMAND_CLASS_VERSION,
-  COMMAND_CLASS_MANUFACTURER_SPECIFIC,
-  COMMAND_CLASS_DEVICE_RESET_LOCALLY,
-  COMMAND_CLASS_POWERLEVEL,
-  COMMAND_CLASS_SECURITY,
-  COMMAND_CLASS_SECURITY_2,
-  COMMAND_CLASS_SUPERVISION
-#ifdef BOOTLOADER_ENABLED
-  ,COMMAND_CLASS_FIRMWARE_UPDATE_MD_V2
+ * @def FACTORY_UART_INIT()
+ * Opens the factory UART at 115200 baud.
+ * @def FACTORY_UART_RX_READY()
+ * Tells whether a byte has been received.
+ * @def FACTORY_UART_RX_GET()
+ * Returns the received byte and clears the receive flag.
+ * @def FACTORY_UART_TX(data)
+ * Sends a byte, waiting for the previous one.
+ *
+ * ZW_DEBUG must not use the same UART in a factory build.
+ */
+#ifndef FACTORY_UART_INIT
+#define FACTORY_UART_INIT()      ZW_UART0_init(1152, TRUE, TRUE)
+#define FACTORY_UART_RX_READY()  ZW_UART0_rx_int_get()
+#define FACTORY_UART_RX_GET()    (ZW_UART0_rx_int_clear(), ZW_UART0_rx_data_get())
+#define FACTORY_UART_TX(data)    ZW_UART0_tx_send_byte(data)
 #endif
-};
 
 /**
- * Unsecure node information list Secure included.
- * Be sure Command classes are not duplicated in both lists.
- * CHANGE THIS - Add all supported non-secure command classes here
- **/
-static code BYTE cmdClassListNonSecureIncludedSecure[] =
-{
-  COMMAND_CLASS_ZWAVEPLUS_INFO,
-  COMMAND_CLASS_TRANSPORT_SERVICE_V2,
-  COMMAND_CLASS_SECURITY,
-  COMMAND_CLASS_SECURITY_2
-};
+ * Factory frame: FACTORY_SOF, length, command, payload, checksum. The
+ * length counts command and payload, the checksum is 0xFF XOR length and
+ * all of them. A response has the command with FACTORY_RESPONSE set and a
+ * FACTORY_STATUS_* byte before its payload.
+ */
+#define FACTORY_SOF              0xFA
+#define FACTORY_RESPONSE         0x80
+#define FACTORY_FRAME_MAX        40
+#define FACTORY_DATA_MAX         32
 
+/**
+ * Ticks of 10 ms after startup in which a valid frame enters factory mode,
+ * and the longest gap between the bytes of a frame.
+ */
+#define FACTORY_ENTRY_TICKS      100
+#define FACTORY_BYTE_TIMEOUT     5
 
 /**
- * Secure node inforamtion list.
- * Be sure Command classes are not duplicated in both lists.
- * CHANGE THIS - Add all supported secure command classes here
- **/
-static code BYTE cmdClassListSecure[] =
+ * Version of the factory protocol, reported by FACTORY_CMD_PING.
+ */
+#define FACTORY_PROTOCOL_VERSION 1
+
+/**
+ * Factory commands.
+ */
+typedef enum _FACTORY_CMD_
 {
-  COMMAND_CLASS_VERSION,
-  COMMAND_CLASS_SWITCH_BINARY,
-  COMMAND_CLASS_SWITCH_ALL,
-  COMMAND_CLASS_ASSOCIATION,
-  COMMAND_CLASS_MULTI_CHANNEL_ASSOCIATION_V2,
-  COMMAND_CLASS_ASSOCIATION_GRP_INFO,
-  COMMAND_CLASS_MANUFACTURER_SPECIFIC,
-  COMMAND_CLASS_DEVICE_RESET_LOCALLY,
-  COMMAND_CLASS_POWERLEVEL,
-  COMMAND_CLASS_SUPERVISION
-#ifdef BOOTLOADER_ENABLED
-  ,COMMAND_CLASS_FIRMWARE_UPDATE_MD_V2
-#endif
-};
+  FACTORY_CMD_PING = 0x01,     /* -> app version, revision, protocol */
+  FACTORY_CMD_RELAYS,          /* mask, values -> relay states */
+  FACTORY_CMD_LED,             /* on -> */
+  FACTORY_CMD_KEYS,            /* -> keys down, keys pressed since last */
+  FACTORY_CMD_NVM_READ,        /* offset (2), length -> data */
+  FACTORY_CMD_NVM_WRITE,       /* offset (2), data -> */
+  FACTORY_CMD_NODE_INFO,       /* -> home ID (4), node ID, DSK (16) */
+  FACTORY_CMD_SELF_TEST,       /* -> test result bits, relay states */
+  FACTORY_CMD_EXIT             /* -> */
+} FACTORY_CMD;
 
+/**
+ * Status byte of a factory response.
+ */
+#define FACTORY_STATUS_OK        0x00
+#define FACTORY_STATUS_CHECKSUM  0x01
+#define FACTORY_STATUS_UNKNOWN   0x02
+#define FACTORY_STATUS_PARAM     0x03
+#define FACTORY_STATUS_BUSY      0x04
 
 /**
- * Structure includes application node information list's and device type.
+ * Self-test result bits. The relays are not part of the self-test: the
+ * tester steps them one pattern per FACTORY_CMD_RELAYS and checks each
+ * on its side once the contacts have settled. The NVM test completes in
+ * the write callbacks, so FACTORY_CMD_SELF_TEST is repeated while
+ * FACTORY_TEST_NVM_PENDING is set.
  */
-APP_NODE_INFORMATION m_AppNIF =
+#define FACTORY_TEST_NVM         0x02
+#define FACTORY_TEST_KEYS        0x04
+#define FACTORY_TEST_NVM_PENDING 0x08
+
+/**
+ * States of the NVM self-test.
+ */
+typedef enum _FACTORY_NVM_TEST_
 {
-  cmdClassListNonSecureNotIncluded, sizeof(cmdClassListNonSecureNotIncluded),
-  cmdClassListNonSecureIncludedSecure, sizeof(cmdClassListNonSecureIncludedSecure),
-  cmdClassListSecure, sizeof(cmdClassListSecure),
-  DEVICE_OPTIONS_MASK, GENERIC_TYPE, SPECIFIC_TYPE
-};
+  FACTORY_NVM_TEST_IDLE,
+  FACTORY_NVM_TEST_WRITE_55,
+  FACTORY_NVM_TEST_WRITE_AA,
+  FACTORY_NVM_TEST_PASS,
+  FACTORY_NVM_TEST_FAIL
+} FACTORY_NVM_TEST;
 
 /**
- * AGI lifeline string
+ * Receive states of the factory frame parser.
  */
-const char GroupName[]   = "Lifeline";
+typedef enum _FACTORY_RX_STATE_
+{
+  FACTORY_RX_SOF,
+  FACTORY_RX_LENGTH,
+  FACTORY_RX_DATA,
+  FACTORY_RX_CHECKSUM
+} FACTORY_RX_STATE;
+#endif /* APP_FACTORY_MODE */
 
+
+#ifdef APP_FEATURE_CENTRAL_SCENE
 /**
- * Setup AGI lifeline table from app_config.h
+ * Key events fed to the Central Scene gesture detector.
  */
-CMD_CLASS_GRP  agiTableLifeLine[] = {AGITABLE_LIFELINE_GROUP};
+typedef enum _KEY_GESTURE_
+{
+  KEY_GESTURE_DOWN,
+  KEY_GESTURE_HELD,
+  KEY_GESTURE_UP
+} KEY_GESTURE;
 
 /**
- * Application node ID
+ * Central Scene key attributes reported by this application.
  */
-BYTE myNodeID = 0;
+typedef enum _CENTRAL_SCENE_KEY_ATTRIBUTE_
+{
+  CENTRAL_SCENE_KEY_PRESSED_1_TIME,
+  CENTRAL_SCENE_KEY_RELEASED,
+  CENTRAL_SCENE_KEY_HELD_DOWN,
+  CENTRAL_SCENE_KEY_PRESSED_2_TIMES
+} CENTRAL_SCENE_KEY_ATTRIBUTE;
 
 /**
- * Application state-machine state.
+ * Slow refresh flag in Central Scene notification and configuration frames.
  */
-static STATE_APP currentState = STATE_APP_IDLE;
+#define CENTRAL_SCENE_SLOW_REFRESH_BIT     0x80
 
 /**
- * Parameter is used to save wakeup reason after ApplicationInitHW(..)
+ * Time after a release in which a second release counts as pressed twice,
+ * in 10 ms ticks.
  */
-SW_WAKEUP wakeupReason;
+#define CENTRAL_SCENE_TAP_WINDOW           40
 
 /**
- * LED state
+ * Held down repeat interval in 10 ms ticks, without and with slow refresh.
  */
-static BYTE onOffState;
+#define CENTRAL_SCENE_REFRESH_TICKS        20
+#define CENTRAL_SCENE_SLOW_REFRESH_TICKS   5500
 
 /**
- * Use to tell if the host OTA required auto rebooting or not
+ * Number of Central Scene notifications waiting for the request buffer.
  */
-BOOL userReboot = FALSE;
+#define CENTRAL_SCENE_QUEUE_SIZE           4
+#endif /* APP_FEATURE_CENTRAL_SCENE */
 
-#ifdef APP_SUPPORTS_CLIENT_SIDE_AUTHENTICATION
-s_SecurityS2InclusionCSAPublicDSK_t sCSAResponse = { 0, 0, 0, 0};
-#endif /* APP_SUPPORTS_CLIENT_SIDE_AUTHENTICATION */
+/**
+ * Number of scenes of Scene Actuator Configuration and the size of the RAM
+ * index telling which of them are configured. Also used without
+ * APP_FEATURE_SCENES to size the scene fields of the NVM layout.
+ */
+#define SCENE_COUNT       255
+#define SCENE_INDEX_SIZE  ((SCENE_COUNT + 8) / 8)
 
-/****************************************************************************/
-/*                              EXPORTED DATA                               */
-/****************************************************************************/
+#ifdef APP_FEATURE_SCENES
+/**
+ * A stored scene is one byte: relay values in bits 0-2 and the relays the
+ * scene affects in bits 3-5.
+ */
+#define SCENE_RECORD(mask, values)  (BYTE)((((mask) & RELAY_MASK_ALL) << 3) | ((values) & (mask) & RELAY_MASK_ALL))
+#define SCENE_RECORD_MASK(record)   (BYTE)(((record) >> 3) & RELAY_MASK_ALL)
+#define SCENE_RECORD_VALUES(record) (BYTE)((record) & RELAY_MASK_ALL)
+#endif /* APP_FEATURE_SCENES */
 
-// No exported data.
+/**
+ * Number of relays.
+ */
+#define RELAY_COUNT  3
 
-/****************************************************************************/
-/*                            PRIVATE FUNCTIONS                             */
-/****************************************************************************/
+/**
+ * Timer wheel geometry. The wheel advances one slot per second from a
+ * single ZW_TIMER_START tick. An entry further away than one turn waits
+ * the number of turns given by its rounds counter.
+ */
+#define TIMER_WHEEL_SLOTS_LOG2  6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_SLOTS_LOG2)
+#define TIMER_WHEEL_POOL        32
+#define TIMER_WHEEL_TICKS       100
+#define TIMER_WHEEL_NONE        0xFF
 
-void ZCB_DeviceResetLocallyDone(TRANSMISSION_RESULT * pTransmissionResult);
-void ZCB_Timer1Delay(void);
-void ZCB_Timer2Delay(void);
-void ZCB_Timer3Delay(void);
-STATE_APP GetAppState();
-void AppStateManager( EVENT_APP event);
-void ChangeState( STATE_APP newState);
+/**
+ * List holding the entries that expire in the current tick. It is kept
+ * after the wheel slots so entries can be unlinked the same way anywhere.
+ */
+#define TIMER_WHEEL_EXPIRING    TIMER_WHEEL_SLOTS
 
-#ifdef BOOTLOADER_ENABLED
-void ZCB_OTAFinish(OTA_STATUS otaStatus);
-BOOL ZCB_OTAStart(void);
-void ZCB_OTAWrite(BYTE *pData, BYTE len);
-#endif
+/**
+ * Timer wheel entry actions. Bits 0-1 hold the relay index.
+ */
+#define TW_ACTION_RELAY_MASK    0x03
+#define TW_ACTION_ON            0x04
+#define TW_ACTION_AUTO_OFF      0x10
+#define TW_ACTION_TRANSITION    0x20
+#define TW_ACTION_NVM_FLUSH     0x40
+#define TW_ACTION_SMARTSTART    0x80
 
-void LoadConfiguration(ZW_NVM_STATUS nvmStatus);
-void SetDefaultConfiguration(void);
+/**
+ * SmartStart start delay window in seconds. The delay is random within
+ * the window, and the window doubles on each restart up to the maximum.
+ * The first start after power-up uses SMARTSTART_WINDOW_BOOT, so units
+ * powered up together do not request inclusion at once. The window after
+ * an exclusion starts at SMARTSTART_WINDOW_MIN.
+ */
+#define SMARTSTART_WINDOW_MIN   4
+#define SMARTSTART_WINDOW_BOOT  64
+#define SMARTSTART_WINDOW_MAX   128
 
-void ToggleLed(void);
-void RefreshMMI(void);
+/**
+ * Timer wheel entry, linked into the list of its slot.
+ */
+typedef struct _TIMER_WHEEL_ENTRY_
+{
+  BYTE next;
+  BYTE prev;
+  BYTE slot;
+  BYTE action;
+  WORD rounds;
+} TIMER_WHEEL_ENTRY;
 
+/**
+ * Timer wheel with a fixed pool of entries. Free entries are chained
+ * through next.
+ */
+typedef struct _TIMER_WHEEL_
+{
+  BYTE slots[TIMER_WHEEL_SLOTS + 1];
+  TIMER_WHEEL_ENTRY entries[TIMER_WHEEL_POOL];
+  BYTE freeList;
+  BYTE cursor;
+} TIMER_WHEEL;
 
 /**
- * @brief See description for function prototype in ZW_basis_api.h.
+ * Timed actions of the relays. Handles are timer wheel entries.
  */
-void
-ApplicationRfNotify(BYTE rfState)
+typedef struct _RELAY_TIMERS_
 {
-  UNUSED(rfState);
-}
+  WORD autoOffSeconds[RELAY_COUNT];
+  BYTE autoOff[RELAY_COUNT];
+  BYTE transition[RELAY_COUNT];
+  BYTE target[RELAY_COUNT];
+} RELAY_TIMERS;
 
-/*******************************switch************************************/
-//-------------------relay----------------------
-#define relay1_pin_out() SetPinOut(ZDP03A_LED_D1)
-#define relay2_pin_out() SetPinOut(ZDP03A_LED_D2)
-#define relay3_pin_out() SetPinOut(ZDP03A_LED_D3)
+/**
+ * Configuration parameters, numbered from 1 in table order. All parameters
+ * are two byte unsigned values so Bulk Set and Bulk Get cover any range.
+ */
+typedef enum _CONFIG_PARAM_
+{
+  CONFIG_POWER_ON_STATE,
+  CONFIG_KEY_MODE,
+  CONFIG_AUTO_OFF_RELAY1,
+  CONFIG_AUTO_OFF_RELAY2,
+  CONFIG_AUTO_OFF_RELAY3,
+  CONFIG_LIFELINE_REPORTS,
+#ifdef APP_FEATURE_METER
+  CONFIG_METER_POWER_DELTA,
+  CONFIG_METER_ENERGY_DELTA,
+  CONFIG_METER_REPORT_INTERVAL,
+#endif
+  CONFIG_PARAM_COUNT
+} CONFIG_PARAM;
 
-#define relay1_on()  Led(ZDP03A_LED_D1,ON)
-#define relay1_off() Led(ZDP03A_LED_D1,OFF)
-#define relay2_on()  Led(ZDP03A_LED_D2,ON)
-#define relay2_off() Led(ZDP03A_LED_D2,OFF)
-#define relay3_on()  Led(ZDP03A_LED_D3,ON)
-#define relay3_off() Led(ZDP03A_LED_D3,OFF)
+/**
+ * Configuration parameters reserved in NVM: the parameters of the full
+ * profile, so the NVM layout is the same in every profile.
+ */
+#define CONFIG_PARAM_NVM_COUNT       9
 
-#define relay_init() \
-	relay1_pin_out(); \
-  relay2_pin_out(); \ 
-  relay3_pin_out(); \
-	relay1_off(); \
-	relay2_off(); \
-	relay3_off()
+/**
+ * Version of the application NVM layout. Bump it whenever a field of the
+ * layout is added, moved or changes meaning.
+ */
+#define APP_NVM_LAYOUT_VERSION       2
 
-//-------------------led----------------------
-#define led_nwk_pin_out() SetPinOut(ZDP03A_LED_D6)
+/**
+ * Features whose NVM fields are kept up to date by this build. Fields of
+ * the other features are reserved but never written, so a change of
+ * feature set is treated like a change of layout.
+ */
+#ifdef APP_FEATURE_CENTRAL_SCENE
+#define APP_NVM_FEATURE_CENTRAL_SCENE  0x01
+#else
+#define APP_NVM_FEATURE_CENTRAL_SCENE  0
+#endif
+#ifdef APP_FEATURE_SCENES
+#define APP_NVM_FEATURE_SCENES         0x02
+#else
+#define APP_NVM_FEATURE_SCENES         0
+#endif
+#ifdef APP_FEATURE_METER
+#define APP_NVM_FEATURE_METER          0x04
+#else
+#define APP_NVM_FEATURE_METER          0
+#endif
+#ifdef APP_FEATURE_CONFIGURATION
+#define APP_NVM_FEATURE_CONFIGURATION  0x08
+#else
+#define APP_NVM_FEATURE_CONFIGURATION  0
+#endif
 
-#define led_nwk_on()  Led(ZDP03A_LED_D6,ON)
-#define led_nwk_off() Led(ZDP03A_LED_D6,OFF)
+/**
+ * Layout byte, the first byte of APP_NVM: the layout version in the high
+ * nibble and the APP_NVM_FEATURE_* flags in the low one. If the struct is
+ * moved by a relink, the byte read back no longer matches.
+ */
+#define APP_NVM_LAYOUT  (BYTE)((APP_NVM_LAYOUT_VERSION << 4) | \
+                               APP_NVM_FEATURE_CENTRAL_SCENE | \
+                               APP_NVM_FEATURE_SCENES | \
+                               APP_NVM_FEATURE_METER | \
+                               APP_NVM_FEATURE_CONFIGURATION)
 
-#define led_init() \
-   led_nwk_pin_out(); \
-   led_nwk_off()
+#define CONFIG_PARAM_SIZE            2
+#define CONFIG_FORMAT_UNSIGNED       1
 
-//-------------------key----------------------
-#define EVENT_KEY1_DOWN            EVENT_KEY_B1_DOWN
-#define EVENT_KEY1_UP              EVENT_KEY_B1_UP
-#define EVENT_KEY1_HELD            EVENT_KEY_B1_HELD
-#define EVENT_KEY1_PRESS           EVENT_KEY_B1_PRESS
-#define EVENT_KEY1_HELD_10_SEC     EVENT_KEY_B1_HELD_10_SEC
-#define EVENT_KEY1_TRIPLE_PRESS    EVENT_KEY_B1_TRIPLE_PRESS
-#define EVENT_KEY2_DOWN            EVENT_KEY_B2_DOWN
-#define EVENT_KEY2_UP              EVENT_KEY_B2_UP
-#define EVENT_KEY2_HELD            EVENT_KEY_B2_HELD
-#define EVENT_KEY2_PRESS           EVENT_KEY_B2_PRESS
-#define EVENT_KEY2_HELD_10_SEC     EVENT_KEY_B2_HELD_10_SEC
-#define EVENT_KEY2_TRIPLE_PRESS    EVENT_KEY_B2_TRIPLE_PRESS
-#define EVENT_KEY3_DOWN            EVENT_KEY_B3_DOWN
-#define EVENT_KEY3_UP              EVENT_KEY_B3_UP
-#define EVENT_KEY3_HELD            EVENT_KEY_B3_HELD
-#define EVENT_KEY3_PRESS           EVENT_KEY_B3_PRESS
-#define EVENT_KEY3_HELD_10_SEC     EVENT_KEY_B3_HELD_10_SEC
-#define EVENT_KEY3_TRIPLE_PRESS    EVENT_KEY_B3_TRIPLE_PRESS
+/**
+ * Values of CONFIG_POWER_ON_STATE, CONFIG_KEY_MODE and
+ * CONFIG_LIFELINE_REPORTS.
+ */
+#define CONFIG_POWER_ON_OFF          0
+#define CONFIG_POWER_ON_RESTORE      1
+#define CONFIG_POWER_ON_ON           2
+#define CONFIG_KEY_MODE_RELAY        0
+#define CONFIG_KEY_MODE_DETACHED     1
+#define CONFIG_REPORTS_NONE          0
+#define CONFIG_REPORTS_LOCAL         1
+#define CONFIG_REPORTS_ALL           2
 
-#define key1_pin_in()    SetPinIn(ZDP03A_KEY_1,TRUE) 
-#define key2_pin_in()    SetPinIn(ZDP03A_KEY_2,TRUE)
-#define key3_pin_in()    SetPinIn(ZDP03A_KEY_3,TRUE)
+/**
+ * Compile time description of a configuration parameter.
+ */
+typedef struct _CONFIG_PARAM_INFO_
+{
+  WORD minValue;
+  WORD maxValue;
+  WORD defaultValue;
+#ifdef APP_FEATURE_CONFIGURATION
+  char code *pName;
+  char code *pInfo;
+#endif
+} CONFIG_PARAM_INFO;
 
-#define key_init() \
-	key1_pin_in(); \
-	key2_pin_in(); \
-	key3_pin_in()
-	
-//-------------------switch----------------------
-typedef struct {
-	BYTE s1:1;
-	BYTE s2:1;
-	BYTE s3:1;
-	BYTE learn:1;
-	BYTE tmr_handle;
-}switch_state_t;
-static switch_state_t switch_state;
+/**
+ * @def CONFIG_PARAM_TEXT(name, info)
+ * Name and description of a parameter in configParamInfo. They are only
+ * linked with APP_FEATURE_CONFIGURATION, which reports them.
+ */
+#ifdef APP_FEATURE_CONFIGURATION
+#define CONFIG_PARAM_TEXT(name, info) , name, info
+#else
+#define CONFIG_PARAM_TEXT(name, info)
+#endif
 
-#define switch_init() relay_init(); \
-                      led_init(); \
-                      key_init(); \
-                      switch_state.s1 = 0; \
+#ifdef APP_FEATURE_CONFIGURATION
+/**
+ * Properties of Configuration Set, Bulk Set and Bulk Report frames.
+ */
+#define CONFIG_PROPERTIES_DEFAULT    0x80
+#define CONFIG_PROPERTIES_HANDSHAKE  0x40
+#define CONFIG_PROPERTIES_SIZE_MASK  0x07
+
+/**
+ * Largest number of parameters in one Bulk Report.
+ */
+#define CONFIG_BULK_MAX              16
+
+/**
+ * Largest number of characters in one Name Report or Info Report. Longer
+ * strings are split over several reports.
+ */
+#define CONFIG_TEXT_CHUNK            20
+
+/**
+ * Name Report or Info Report in progress. pText is the rest of the string
+ * still to send, NULL when no report is in progress.
+ */
+typedef struct _CONFIG_TEXT_STATE_
+{
+  RECEIVE_OPTIONS_TYPE_EX rxOpt;
+  char code *pText;
+  WORD number;
+  BYTE cmd;
+} CONFIG_TEXT_STATE;
+#endif /* APP_FEATURE_CONFIGURATION */
+
+/**
+ * Seconds configuration and relay state changes are held in RAM before
+ * they are written to NVM.
+ */
+#define NVM_FLUSH_DELAY              3
+
+/**
+ * RAM copies that differ from NVM.
+ */
+#define NVM_DIRTY_CONFIG             0x01
+#define NVM_DIRTY_RELAYS             0x02
+#define NVM_DIRTY_METER              0x04
+#define NVM_DIRTY_CRASH              0x08
+#define NVM_DIRTY_CENTRAL_SCENE      0x10
+
+#ifdef APP_FEATURE_METER
+/**
+ * Meter Report fields: electric meter, import rate, and the scales
+ * supported. Energy is reported in 0.01 kWh, power in 0.1 W.
+ */
+#define METER_TYPE_ELECTRIC          0x01
+#define METER_RATE_IMPORT            0x01
+#define METER_SCALE_KWH              0
+#define METER_SCALE_W                2
+#define METER_SCALES_SUPPORTED       ((1 << METER_SCALE_KWH) | (1 << METER_SCALE_W))
+#define METER_ENERGY_PRECISION       2
+#define METER_ENERGY_SIZE            4
+#define METER_POWER_PRECISION        1
+#define METER_POWER_SIZE             2
+
+/**
+ * Deci-watt-seconds in one energy unit of 0.01 kWh.
+ */
+#define METER_DWS_PER_UNIT           360000UL
+
+/**
+ * Energy units accumulated before the energy is written to NVM again.
+ */
+#define METER_NVM_STEP               10
+
+/**
+ * Seconds after a meter report before another one for the same relay.
+ */
+#define METER_REPORT_HOLDOFF         5
+
+/**
+ * @def METER_SAMPLE_POWER(relay)
+ * Returns the power drawn through a relay in 0.1 W. Called once per second.
+ * Defaults to METER_NOMINAL_POWER while the relay is on, for hardware
+ * without current sensing. A board with an ADC, or a host build with a
+ * simulated source, maps it to its own sampler. With neither there is
+ * nothing to measure, and the meter must not report made-up values.
+ */
+#ifndef METER_SAMPLE_POWER
+#ifndef METER_NOMINAL_POWER
+#error "APP_FEATURE_METER needs METER_SAMPLE_POWER(relay) or METER_NOMINAL_POWER in config_app.h"
+#endif
+#define METER_SAMPLE_POWER(relay) \
+  ((relayLastState & (1 << (relay))) ? (WORD)METER_NOMINAL_POWER : (WORD)0)
+#endif
+
+/**
+ * Meter state of one relay.
+ */
+typedef struct _METER_RELAY_
+{
+  DWORD energy;          /* 0.01 kWh */
+  DWORD residue;         /* Deci-watt-seconds below one energy unit */
+  DWORD energyReported;
+  DWORD energySaved;
+  WORD power;            /* 0.1 W */
+  WORD powerReported;
+  WORD sinceReport;      /* Seconds since the last energy report */
+  BYTE holdoff;          /* Seconds before the next report may be sent */
+} METER_RELAY;
+
+/**
+ * Bits of meterReportPending: energy reports in bits 0-2, power reports in
+ * bits 4-6.
+ */
+#define METER_PENDING_POWER_SHIFT    4
+#endif /* APP_FEATURE_METER */
+
+/**
+ * Fields of the static Z-Wave Plus Info Report. They follow the SDK
+ * handler: Z-Wave Plus version 2 and the role, node and icon types of
+ * config_app.h, which must define APP_ROLE_TYPE, APP_ICON_TYPE and
+ * APP_USER_ICON_TYPE.
+ */
+#ifndef APP_ZWAVEPLUS_VERSION
+#ifdef ZW_PLUS_VERSION
+#define APP_ZWAVEPLUS_VERSION        ZW_PLUS_VERSION
+#else
+#define APP_ZWAVEPLUS_VERSION        2
+#endif
+#endif
+#ifndef APP_NODE_TYPE
+#define APP_NODE_TYPE                ZWAVEPLUS_INFO_REPORT_NODE_TYPE_ZWAVEPLUS_NODE
+#endif
+#if !defined(APP_ROLE_TYPE) || !defined(APP_ICON_TYPE) || !defined(APP_USER_ICON_TYPE)
+#error "config_app.h must define APP_ROLE_TYPE, APP_ICON_TYPE and APP_USER_ICON_TYPE"
+#endif
+
+/**
+ * Node ID as used by application owned tables. The 500 series protocol
+ * library only has 8 bit node IDs (no Long Range); application code
+ * written against this type is unaffected by a move to 16 bit IDs.
+ */
+typedef BYTE APP_NODE_ID;
+
+/**
+ * Association groups: the lifeline and one control group per key.
+ */
+#define ASSOC_GROUP_LIFELINE         1
+#define ASSOC_GROUP_KEY_FIRST        2
+
+/**
+ * Reports that never change. They are serialized at compile time into code
+ * memory and answered by one copy into the response buffer.
+ */
+typedef enum _RESPONSE_CACHE_ID_
+{
+  RESPONSE_CACHE_MANUFACTURER_SPECIFIC,
+  RESPONSE_CACHE_ZWAVEPLUS_INFO,
+  RESPONSE_CACHE_COUNT
+} RESPONSE_CACHE_ID;
+
+/**
+ * Location and length of a static report.
+ */
+typedef struct _RESPONSE_CACHE_ENTRY_
+{
+  BYTE code *pReport;
+  BYTE length;
+} RESPONSE_CACHE_ENTRY;
+
+#ifdef APP_FEATURE_CENTRAL_SCENE
+/**
+ * Queued Central Scene notification.
+ */
+typedef struct _CENTRAL_SCENE_EVENT_
+{
+  BYTE sceneNumber;
+  BYTE keyAttribute;
+} CENTRAL_SCENE_EVENT;
+
+/**
+ * Central Scene gesture detector and notification queue.
+ */
+typedef struct _CENTRAL_SCENE_STATE_
+{
+  CENTRAL_SCENE_EVENT queue[CENTRAL_SCENE_QUEUE_SIZE];
+  BYTE queueHead;
+  BYTE queueCount;
+  BYTE sequenceNumber;
+  BYTE key;
+  BYTE taps;
+  BOOL held;
+  BOOL slowRefresh;
+  BYTE windowTimer;
+  BYTE refreshTimer;
+} CENTRAL_SCENE_STATE;
+#endif /* APP_FEATURE_CENTRAL_SCENE */
+
+
+/**
+ * Commands of the Manufacturer Proprietary diagnostics protocol. A frame is
+ * cmdClass, manufacturer ID (MSB, LSB), command and page.
+ */
+typedef enum _DIAG_CMD_
+{
+  DIAG_CMD_GET = 0x01,
+  DIAG_CMD_REPORT,
+  DIAG_CMD_RESET
+} DIAG_CMD;
+
+/**
+ * Offsets in a Manufacturer Proprietary diagnostics frame.
+ */
+#define DIAG_OFFSET_CMD   3
+#define DIAG_OFFSET_PAGE  4
+#define DIAG_OFFSET_DATA  5
+
+/**
+ * Diagnostics page holding the poll, OTA and per-state counters. Pages from
+ * DIAG_PAGE_CLASS_FIRST hold one tracked command class each.
+ */
+#define DIAG_PAGE_SUMMARY      0
+#define DIAG_PAGE_CLASS_FIRST  1
+
+/**
+ * Diagnostics page holding the slowest frame dispatched since the last
+ * reset: its handler time, its length and its first DIAG_WORST_BYTES
+ * bytes.
+ */
+#define DIAG_PAGE_WORST        0xE0
+
+/**
+ * Crash record pages: the record of the previous run, prefixed by the
+ * wakeup reason of this boot, and the record of the current run. They are
+ * available with and without APP_DIAGNOSTICS, to frames received on the
+ * highest granted security key only.
+ */
+#define DIAG_PAGE_CRASH_PREVIOUS  0xF0
+#define DIAG_PAGE_CRASH_CURRENT   0xF1
+
+/**
+ * Link statistics pages, LINK_STATS_PER_PAGE entries each, and the page
+ * number of a link alert pushed on the lifeline.
+ */
+#define DIAG_PAGE_LINK_FIRST      0xF2
+#define DIAG_PAGE_LINK_ALERT      0xFA
+
+/**
+ * Reset causes written to the crash record by the application reset paths.
+ * CRASH_CAUSE_NONE together with a watchdog wakeup reason means the
+ * watchdog tripped, a power-on wakeup means the supply was lost.
+ */
+#define CRASH_CAUSE_NONE       0
+#define CRASH_CAUSE_APP_RESET  1
+#define CRASH_CAUSE_OTA        2
+
+/**
+ * Kinds of crash ring events. CRASH_EVENT_EMPTY marks unused entries.
+ */
+#define CRASH_EVENT_EMPTY      0
+#define CRASH_EVENT_APP        1
+#define CRASH_EVENT_FRAME      2
+#define CRASH_EVENT_STATE      3
+
+/**
+ * Number of events kept in the crash ring. Must be a power of two.
+ */
+#define CRASH_RING_SIZE        8
+
+/**
+ * Seconds between write-backs of the crash record while new frame events
+ * are in it. State changes and the reset paths write it sooner.
+ */
+#define CRASH_RING_FLUSH_INTERVAL  3600
+
+/**
+ * Number of peers with link statistics, and entries per report page.
+ */
+#define LINK_STATS_SIZE        8
+#define LINK_STATS_PER_PAGE    4
+
+/**
+ * Consecutive failed transmissions to a peer that push a link alert on the
+ * lifeline.
+ */
+#define LINK_FAIL_ALERT        3
+
+/**
+ * Follow-up frames caused by a broadcast or multicast are held for a node
+ * specific delay, in 10 ms ticks: GROUPCAST_JITTER_BASE plus the node ID
+ * times GROUPCAST_JITTER_STEP modulo GROUPCAST_JITTER_SPAN. Nodes switched
+ * by the same frame then answer at different times.
+ */
+#define GROUPCAST_JITTER_BASE  10
+#define GROUPCAST_JITTER_STEP  37
+#define GROUPCAST_JITTER_SPAN  200
+
+/**
+ * Longest time AppReboot() waits for pending transmissions, in 10 ms
+ * ticks.
+ */
+#define APP_REBOOT_DRAIN_TICKS  200
+
+/**
+ * Delay before pending unsolicited frames are retried when another job
+ * holds the request buffer, in 10 ms ticks.
+ */
+#define APP_REQUEST_RETRY_TICKS  10
+
+/**
+ * No reboot requested.
+ */
+#define APP_REBOOT_NONE        0xFF
+
+/**
+ * @def APP_SOFT_RESET()
+ * Resets the chip. The 500 series library has no software reset call, so
+ * the default is a watchdog reset: enable the watchdog and spin until it
+ * fires, about one second. Every reboot therefore still ends with the full
+ * watchdog timeout; only a board with a direct reset line, mapping this
+ * macro to it, resets at once.
+ */
+#ifndef APP_SOFT_RESET
+#define APP_SOFT_RESET() do { ZW_WatchDogEnable(); for (;;) {} } while (0)
+#endif
+
+/**
+ * Marks a crash record in NVM as valid.
+ */
+#define CRASH_RECORD_MAGIC     0xC5
+
+/**
+ * One crash ring event: an AppStateManager event or a received command
+ * class.
+ */
+typedef struct _CRASH_EVENT_
+{
+  BYTE kind;
+  BYTE value;
+} CRASH_EVENT;
+
+/**
+ * Link statistics of one peer. Transmissions are the application's own
+ * unsolicited frames; receptions are all frames from the peer.
+ */
+typedef struct _LINK_STATS_ENTRY_
+{
+  APP_NODE_ID nodeId;
+  WORD txCount;
+  WORD txFail;
+  WORD rxCount;
+  BYTE failStreak;
+} LINK_STATS_ENTRY;
+
+/**
+ * Reset cause, uptime in seconds and the last events of one run. head is
+ * the index the next event is written to, so it is also the oldest event.
+ */
+typedef struct _CRASH_RECORD_
+{
+  BYTE magic;
+  BYTE resetCause;
+  DWORD uptime;
+  BYTE head;
+  CRASH_EVENT events[CRASH_RING_SIZE];
+} CRASH_RECORD;
+
+/**
+ * Application NVM layout. The fields are members of one struct because
+ * Keil C51 does not promise to keep separate far variables in declaration
+ * order. Every field is reserved in every profile and build mode. The
+ * layout byte comes first and checks the rest, see APP_NVM_LAYOUT. New
+ * fields go at the end.
+ */
+typedef struct _APP_NVM_
+{
+  BYTE layout;
+  BYTE centralSceneSlowRefresh;
+  DWORD meterEnergy[RELAY_COUNT];
+  WORD configParams[CONFIG_PARAM_NVM_COUNT];
+  BYTE sceneIndex[SCENE_INDEX_SIZE];
+  BYTE sceneTable[SCENE_COUNT];
+  BYTE factoryScratch;
+  BYTE crashRecord[sizeof(CRASH_RECORD)];
+} APP_NVM;
+
+#ifdef APP_DIAGNOSTICS
+/**
+ * Number of command classes counted separately. Further classes share the
+ * last slot, reported with class 0xFF.
+ */
+#define DIAG_CLASS_SLOTS   12
+
+/**
+ * Number of log2 buckets in the handler time histogram of a class.
+ */
+#define DIAG_HIST_BUCKETS  6
+
+/**
+ * Number of leading bytes kept of the slowest frame. Frames may be
+ * decrypted S2 payloads, so only the command class and command are kept,
+ * unless a lab build defines APP_DIAGNOSTICS_LAB.
+ */
+#ifdef APP_DIAGNOSTICS_LAB
+#define DIAG_WORST_BYTES   16
+#else
+#define DIAG_WORST_BYTES   2
+#endif
+
+/**
+ * Format of the diagnostics pages, first data byte of each of them. Bump
+ * it whenever a page changes layout.
+ * - 1: class pages without the maximum handler time.
+ * - 2: class pages with the maximum handler time, the worst frame page.
+ */
+#define DIAG_FORMAT_VERSION  2
+
+/**
+ * Number of application states counted by DIAG_APP_EVENT().
+ */
+#define DIAG_STATE_SLOTS   (STATE_APP_FACTORY + 1)
+
+/**
+ * Frame counter and handler time histogram of one command class.
+ */
+typedef struct _DIAG_CLASS_STAT_
+{
+  BYTE cmdClass;
+  WORD frames;
+  WORD maxTime;
+  WORD hist[DIAG_HIST_BUCKETS];
+} DIAG_CLASS_STAT;
+
+/**
+ * Hot-path counters. Rates are sampled over one second windows.
+ */
+typedef struct _DIAG_DATA_
+{
+  DIAG_CLASS_STAT classStat[DIAG_CLASS_SLOTS];
+  WORD stateEvents[DIAG_STATE_SLOTS];
+  WORD frameStart;
+  WORD worstTime;
+  BYTE worstLength;
+  BYTE worstFrame[DIAG_WORST_BYTES];
+  WORD pollStart;
+  WORD pollMax;
+  WORD pollCount;
+  WORD pollsPerSec;
+  WORD otaBytes;
+  BYTE otaFragments;
+  WORD otaBytesPerSec;
+  BYTE otaFragmentsPerSec;
+  DWORD otaBytesTotal;
+  WORD windowStart;
+} DIAG_DATA;
+#endif /* APP_DIAGNOSTICS */
+
+
+/****************************************************************************/
+/*                              PRIVATE DATA                                */
+/****************************************************************************/
+
+/**
+ * Unsecure node information list.
+ * Be sure Command classes are not duplicated in both lists.
+ * CHANGE THIS - Add all supported non-secure command classes here
+ **/
+static code BYTE cmdClassListNonSecureNotIncluded[] =
+{
+  COMMAND_CLASS_ZWAVEPLUS_INFO,
+  COMMAND_CLASS_SWITCH_BINARY,
+  COMMAND_CLASS_SWITCH_ALL,
+#ifdef APP_FEATURE_CENTRAL_SCENE
+  COMMAND_CLASS_CENTRAL_SCENE,
+#endif
+#ifdef APP_FEATURE_SCENES
+  COMMAND_CLASS_SCENE_ACTIVATION,
+  COMMAND_CLASS_SCENE_ACTUATOR_CONF,
+#endif
+#ifdef APP_FEATURE_CONFIGURATION
+  COMMAND_CLASS_CONFIGURATION,
+#endif
+#ifdef APP_FEATURE_METER
+  COMMAND_CLASS_METER,
+#endif
+  COMMAND_CLASS_ASSOCIATION,
+  COMMAND_CLASS_MULTI_CHANNEL_ASSOCIATION_V2,
+  COMMAND_CLASS_ASSOCIATION_GRP_INFO,
+  COMMAND_CLASS_TRANSPORT_SERVICE_V2,
+  COMMAND_CLASS_VERSION,
+  COMMAND_CLASS_MANUFACTURER_SPECIFIC,
+  COMMAND_CLASS_DEVICE_RESET_LOCALLY,
+  COMMAND_CLASS_POWERLEVEL,
+  COMMAND_CLASS_SECURITY,
+  COMMAND_CLASS_SECURITY_2,
+  COMMAND_CLASS_SUPERVISION
+#ifdef BOOTLOADER_ENABLED
+  ,COMMAND_CLASS_FIRMWARE_UPDATE_MD_V2
+#endif
+};
+
+/**
+ * Unsecure node information list Secure included.
+ * Be sure Command classes are not duplicated in both lists.
+ * CHANGE THIS - Add all supported non-secure command classes here
+ **/
+static code BYTE cmdClassListNonSecureIncludedSecure[] =
+{
+  COMMAND_CLASS_ZWAVEPLUS_INFO,
+  COMMAND_CLASS_TRANSPORT_SERVICE_V2,
+  COMMAND_CLASS_SECURITY,
+  COMMAND_CLASS_SECURITY_2
+};
+
+
+/**
+ * Secure node inforamtion list.
+ * Be sure Command classes are not duplicated in both lists.
+ * CHANGE THIS - Add all supported secure command classes here
+ **/
+static code BYTE cmdClassListSecure[] =
+{
+  COMMAND_CLASS_VERSION,
+  COMMAND_CLASS_SWITCH_BINARY,
+  COMMAND_CLASS_SWITCH_ALL,
+#ifdef APP_FEATURE_CENTRAL_SCENE
+  COMMAND_CLASS_CENTRAL_SCENE,
+#endif
+#ifdef APP_FEATURE_SCENES
+  COMMAND_CLASS_SCENE_ACTIVATION,
+  COMMAND_CLASS_SCENE_ACTUATOR_CONF,
+#endif
+#ifdef APP_FEATURE_CONFIGURATION
+  COMMAND_CLASS_CONFIGURATION,
+#endif
+#ifdef APP_FEATURE_METER
+  COMMAND_CLASS_METER,
+#endif
+  COMMAND_CLASS_ASSOCIATION,
+  COMMAND_CLASS_MULTI_CHANNEL_ASSOCIATION_V2,
+  COMMAND_CLASS_ASSOCIATION_GRP_INFO,
+  COMMAND_CLASS_MANUFACTURER_SPECIFIC,
+  COMMAND_CLASS_DEVICE_RESET_LOCALLY,
+  COMMAND_CLASS_POWERLEVEL,
+  COMMAND_CLASS_SUPERVISION
+#ifdef BOOTLOADER_ENABLED
+  ,COMMAND_CLASS_FIRMWARE_UPDATE_MD_V2
+#endif
+};
+
+
+/**
+ * Structure includes application node information list's and device type.
+ */
+APP_NODE_INFORMATION m_AppNIF =
+{
+  cmdClassListNonSecureNotIncluded, sizeof(cmdClassListNonSecureNotIncluded),
+  cmdClassListNonSecureIncludedSecure, sizeof(cmdClassListNonSecureIncludedSecure),
+  cmdClassListSecure, sizeof(cmdClassListSecure),
+  DEVICE_OPTIONS_MASK, GENERIC_TYPE, SPECIFIC_TYPE
+};
+
+/**
+ * AGI lifeline string
+ */
+const char GroupName[]   = "Lifeline";
+
+/**
+ * Setup AGI lifeline table from app_config.h
+ */
+CMD_CLASS_GRP  agiTableLifeLine[] = {AGITABLE_LIFELINE_GROUP
+#ifdef APP_FEATURE_LINK_STATS
+                                     ,{COMMAND_CLASS_MANUFACTURER_PROPRIETARY, DIAG_CMD_REPORT}
+#endif
+#ifdef APP_FEATURE_CENTRAL_SCENE
+                                     ,{COMMAND_CLASS_CENTRAL_SCENE, CENTRAL_SCENE_NOTIFICATION_V3}
+#endif
+#ifdef APP_FEATURE_METER
+                                     ,{COMMAND_CLASS_METER, METER_REPORT_V3}
+#endif
+                                    };
+
+/**
+ * AGI profile of the lifeline group, used for unsolicited reports.
+ */
+static AGI_PROFILE lifelineProfile = {ASSOCIATION_GROUP_INFO_REPORT_PROFILE_GENERAL,
+                                      ASSOCIATION_GROUP_INFO_REPORT_PROFILE_GENERAL_LIFELINE};
+
+/**
+ * Control group per key (association groups 2 to 4). Each key sends Basic
+ * Set to its group when it toggles the local relay.
+ * MAX_ASSOCIATION_GROUPS in config_app.h must include these groups.
+ */
+#ifndef AGITABLE_KEY_GROUPS
+#define AGITABLE_KEY_GROUPS \
+  {{ASSOCIATION_GROUP_INFO_REPORT_PROFILE_CONTROL, ASSOCIATION_GROUP_INFO_REPORT_PROFILE_CONTROL_KEY01}, \
+    {COMMAND_CLASS_BASIC, BASIC_SET}, {"Key 1"}}, \
+  {{ASSOCIATION_GROUP_INFO_REPORT_PROFILE_CONTROL, ASSOCIATION_GROUP_INFO_REPORT_PROFILE_CONTROL_KEY02}, \
+    {COMMAND_CLASS_BASIC, BASIC_SET}, {"Key 2"}}, \
+  {{ASSOCIATION_GROUP_INFO_REPORT_PROFILE_CONTROL, ASSOCIATION_GROUP_INFO_REPORT_PROFILE_CONTROL_KEY03}, \
+    {COMMAND_CLASS_BASIC, BASIC_SET}, {"Key 3"}}
+#endif
+AGI_GROUP agiTableKeyGroups[] = {AGITABLE_KEY_GROUPS};
+
+/**
+ * Number of keys with a control group.
+ */
+#define NUMBER_OF_KEY_GROUPS (sizeof(agiTableKeyGroups)/sizeof(AGI_GROUP))
+
+/**
+ * Application node ID
+ */
+BYTE myNodeID = 0;
+
+/**
+ * Application state-machine state.
+ */
+static STATE_APP currentState = STATE_APP_IDLE;
+
+/**
+ * Parameter is used to save wakeup reason after ApplicationInitHW(..)
+ */
+SW_WAKEUP wakeupReason;
+
+/**
+ * Use to tell if the host OTA required auto rebooting or not
+ */
+BOOL userReboot = FALSE;
+
+/**
+ * Keys with a Basic Set waiting for the request buffer, one bit per key.
+ */
+static BYTE keyGroupPending = 0;
+
+/**
+ * Basic Set value of each pending key, one bit per key.
+ */
+static BYTE keyGroupValue = 0;
+
+#ifdef APP_FEATURE_CENTRAL_SCENE
+/**
+ * Central Scene gesture detector and notification queue.
+ */
+static CENTRAL_SCENE_STATE centralScene;
+#endif /* APP_FEATURE_CENTRAL_SCENE */
+
+#ifdef APP_FEATURE_SCENES
+/**
+ * Configured scenes, one bit per scene ID. RAM copy of
+ * EEOFFSET_APP_far.sceneIndex loaded at boot.
+ */
+static BYTE sceneIndex[SCENE_INDEX_SIZE];
+
+/**
+ * Last activated scene, 0 once a relay is changed by anything else.
+ */
+static BYTE sceneActive = 0;
+#endif /* APP_FEATURE_SCENES */
+
+/**
+ * Timer wheel holding the timed relay actions.
+ */
+static TIMER_WHEEL timerWheel;
+
+/**
+ * Auto-off and duration handles of the relays.
+ */
+static RELAY_TIMERS relayTimers;
+
+/**
+ * TRUE while a received frame is dispatched. Relay changes made meanwhile
+ * are remote changes.
+ */
+static BOOL rxFrameInProgress = FALSE;
+
+/**
+ * TRUE while a singlecast frame from the only lifeline member is
+ * dispatched. That node knows the result of its own command, so relay
+ * changes made meanwhile are not reported back to it.
+ */
+static BOOL rxFromLifeline = FALSE;
+
+/**
+ * Timer holding unsolicited frames after a broadcast or multicast.
+ */
+static BYTE groupcastHoldTimer = APP_TIMER_NONE;
+
+/**
+ * TRUE from an accepted firmware update start until it finishes. Periodic
+ * lifeline traffic is held meanwhile so it does not compete with the
+ * fragments on the routes of the update.
+ */
+static BOOL otaActive = FALSE;
+
+/**
+ * Relay states as last seen by RelayChanged(), one bit per relay.
+ */
+static BYTE relayLastState = 0;
+
+/**
+ * Relays with a lifeline Binary Switch Report waiting, one bit per relay.
+ */
+static BYTE relayReportPending = 0;
+
+#ifdef APP_FEATURE_METER
+/**
+ * Meter state per relay and the meter reports waiting for the request
+ * buffer.
+ */
+static METER_RELAY meter[RELAY_COUNT];
+static BYTE meterReportPending = 0;
+#endif /* APP_FEATURE_METER */
+
+/**
+ * Configuration parameter table. Parameter numbers are the index plus one.
+ */
+static code CONFIG_PARAM_INFO configParamInfo[CONFIG_PARAM_COUNT] =
+{
+  {0, 2, CONFIG_POWER_ON_OFF CONFIG_PARAM_TEXT("Power-on state", "0 off, 1 restore last state, 2 on")},
+  {0, 1, CONFIG_KEY_MODE_RELAY CONFIG_PARAM_TEXT("Key mode", "0 key toggles relay, 1 key only controls its group")},
+  {0, 43200, 0 CONFIG_PARAM_TEXT("Auto-off relay 1", "Seconds until relay 1 turns off, 0 disabled")},
+  {0, 43200, 0 CONFIG_PARAM_TEXT("Auto-off relay 2", "Seconds until relay 2 turns off, 0 disabled")},
+  {0, 43200, 0 CONFIG_PARAM_TEXT("Auto-off relay 3", "Seconds until relay 3 turns off, 0 disabled")},
+  {0, 2, CONFIG_REPORTS_ALL CONFIG_PARAM_TEXT("Lifeline reports", "0 none, 1 local changes, 2 all changes")},
+#ifdef APP_FEATURE_METER
+  {0, 10000, 10 CONFIG_PARAM_TEXT("Meter power delta", "Power change in W that triggers a report, 0 disabled")},
+  {0, 10000, 10 CONFIG_PARAM_TEXT("Meter energy delta", "Energy change in 0.01 kWh that triggers a report, 0 disabled")},
+  {0, 43200, 3600 CONFIG_PARAM_TEXT("Meter report interval", "Seconds after which any energy change is reported, 0 disabled")},
+#endif
+};
+
+/**
+ * RAM cache of the configuration parameters.
+ */
+static WORD configValues[CONFIG_PARAM_COUNT];
+
+#ifdef APP_FEATURE_CONFIGURATION
+/**
+ * Name Report or Info Report being sent.
+ */
+static CONFIG_TEXT_STATE configText;
+#endif
+
+/**
+ * Timer wheel entry of the pending SmartStart start and the current delay
+ * window.
+ */
+static BYTE smartStartHandle = TIMER_WHEEL_NONE;
+static BYTE smartStartWindow = SMARTSTART_WINDOW_BOOT;
+
+/**
+ * Unit specific offset of the SmartStart delays, folded from the DSK.
+ * Home ID and node ID are still 0 before inclusion, and the random
+ * generator may run the same sequence on every unit after power-up.
+ */
+static WORD smartStartSeed = 0;
+
+/**
+ * NVM_DIRTY_* flags and the timer wheel entry of the pending NVM flush.
+ */
+static BYTE nvmDirty = 0;
+static BYTE nvmFlushHandle = TIMER_WHEEL_NONE;
+
+/**
+ * Static reports, indexed by RESPONSE_CACHE_ID.
+ */
+static code BYTE manufacturerSpecificReport[] =
+{
+  COMMAND_CLASS_MANUFACTURER_SPECIFIC, MANUFACTURER_SPECIFIC_REPORT,
+  (BYTE)(APP_MANUFACTURER_ID >> 8), (BYTE)APP_MANUFACTURER_ID,
+  (BYTE)(APP_PRODUCT_TYPE_ID >> 8), (BYTE)APP_PRODUCT_TYPE_ID,
+  (BYTE)(APP_PRODUCT_ID >> 8), (BYTE)APP_PRODUCT_ID
+};
+static code BYTE zwavePlusInfoReport[] =
+{
+  COMMAND_CLASS_ZWAVEPLUS_INFO, ZWAVEPLUS_INFO_REPORT_V2,
+  APP_ZWAVEPLUS_VERSION, APP_ROLE_TYPE, APP_NODE_TYPE,
+  (BYTE)(APP_ICON_TYPE >> 8), (BYTE)APP_ICON_TYPE,
+  (BYTE)(APP_USER_ICON_TYPE >> 8), (BYTE)APP_USER_ICON_TYPE
+};
+static code RESPONSE_CACHE_ENTRY responseCache[RESPONSE_CACHE_COUNT] =
+{
+  {manufacturerSpecificReport, sizeof(manufacturerSpecificReport)},
+  {zwavePlusInfoReport, sizeof(zwavePlusInfoReport)}
+};
+
+#ifdef APP_SUPPORTS_CLIENT_SIDE_AUTHENTICATION
+s_SecurityS2InclusionCSAPublicDSK_t sCSAResponse = { 0, 0, 0, 0};
+#endif /* APP_SUPPORTS_CLIENT_SIDE_AUTHENTICATION */
+
+#ifdef APP_DIAGNOSTICS
+/**
+ * Hot-path counters read through the Manufacturer Proprietary diagnostics
+ * command.
+ */
+static DIAG_DATA diag;
+#endif
+
+#ifdef APP_FEATURE_CRASH_RING
+/**
+ * Crash record of the current run, written to NVM after state changes,
+ * hourly while events come in and on the reset paths, and the record the
+ * previous run left in NVM.
+ */
+static CRASH_RECORD crashRecord;
+static CRASH_RECORD crashPrevious;
+
+/**
+ * TRUE when events were added to crashRecord since it was last written.
+ */
+static BOOL crashRecordDirty = FALSE;
+#endif /* APP_FEATURE_CRASH_RING */
+
+/**
+ * Reset cause of a requested reboot, APP_REBOOT_NONE if none, and the
+ * timer limiting how long pending work may delay it.
+ */
+static BYTE rebootCause = APP_REBOOT_NONE;
+static BYTE rebootTimer = APP_TIMER_NONE;
+static BOOL rebootStarted = FALSE;
+
+#ifdef APP_FEATURE_LINK_STATS
+/**
+ * Link statistics per peer, and the entries with a link alert to push.
+ */
+static LINK_STATS_ENTRY linkStats[LINK_STATS_SIZE];
+static BYTE linkAlertPending = 0;
+
+/**
+ * Lifeline command of a link alert. The second byte of a proprietary frame
+ * is the manufacturer ID, so the frame itself cannot be used as the AGI
+ * command.
+ */
+static CMD_CLASS_GRP linkAlertCmdGrp = {COMMAND_CLASS_MANUFACTURER_PROPRIETARY, DIAG_CMD_REPORT};
+#endif /* APP_FEATURE_LINK_STATS */
+
+/**
+ * TRUE while an unsolicited application request holds the request buffer.
+ */
+static BOOL appRequestActive = FALSE;
+
+/**
+ * Set by a sender that finds the request buffer held by another job, and
+ * the timer retrying the pending frames then.
+ */
+static BOOL appRequestBusy = FALSE;
+static BYTE appRequestRetryTimer = APP_TIMER_NONE;
+
+#ifdef APP_FACTORY_MODE
+/**
+ * Factory mode state: the entry window, the frame being received, keys
+ * seen since the last FACTORY_CMD_KEYS and the pending NVM write.
+ */
+static BOOL factoryWindowOpen = FALSE;
+static BYTE factoryWindowTimer = APP_TIMER_NONE;
+static FACTORY_RX_STATE factoryRxState = FACTORY_RX_SOF;
+static BYTE factoryRxLength;
+static BYTE factoryRxCount;
+static WORD factoryRxTick;
+static BYTE factoryRx[FACTORY_FRAME_MAX];
+static BYTE factoryTx[FACTORY_FRAME_MAX];
+static BYTE factoryKeysDown = 0;
+static BYTE factoryKeysPressed = 0;
+static BYTE factoryNvmBuffer[FACTORY_DATA_MAX];
+static BOOL factoryNvmBusy = FALSE;
+static FACTORY_NVM_TEST factoryNvmTest = FACTORY_NVM_TEST_IDLE;
+static BYTE factoryPublicKey[32];
+#endif
+
+/**
+ * Application NVM, one object so the linker cannot reorder its fields.
+ */
+APP_NVM far EEOFFSET_APP_far;
+
+/****************************************************************************/
+/*                              EXPORTED DATA                               */
+/****************************************************************************/
+
+// No exported data.
+
+/****************************************************************************/
+/*                            PRIVATE FUNCTIONS                             */
+/****************************************************************************/
+
+void ZCB_DeviceResetLocallyDone(TRANSMISSION_RESULT * pTransmissionResult);
+void ZCB_Timer1Delay(void);
+void ZCB_Timer2Delay(void);
+void ZCB_Timer3Delay(void);
+STATE_APP GetAppState();
+void AppStateManager( EVENT_APP event);
+void ChangeState( STATE_APP newState);
+
+#ifdef BOOTLOADER_ENABLED
+void ZCB_OTAFinish(OTA_STATUS otaStatus);
+BOOL ZCB_OTAStart(void);
+void ZCB_OTAWrite(BYTE *pData, BYTE len);
+#endif
+
+void LoadConfiguration(ZW_NVM_STATUS nvmStatus);
+void SetDefaultConfiguration(void);
+
+static void RelayChanged(BYTE relay, BYTE on);
+
+static void TimerWheelInit(void);
+static BYTE TimerWheelInsert(WORD delay, BYTE action);
+static void TimerWheelCancel(BYTE *pHandle);
+static WORD TimerWheelRemaining(BYTE handle);
+void ZCB_TimerWheelTick(void);
+static WORD DurationToSeconds(BYTE duration);
+static received_frame_status_t BinarySwitchSetTimed(BYTE relay, BYTE value, BYTE duration);
+static BYTE SecondsToDuration(WORD seconds);
+#ifdef APP_FEATURE_SCENES
+static BYTE SceneEndpointMask(BYTE endpoint);
+#endif
+
+static BOOL AssocGroupEmpty(BYTE groupId);
+static BOOL AssocIsOnlyMember(BYTE groupId, APP_NODE_ID nodeId);
+
+static void KeyPressed(BYTE key);
+static void GroupcastReceived(RECEIVE_OPTIONS_TYPE_EX *rxOpt);
+void ZCB_GroupcastHoldDone(void);
+#ifdef APP_FACTORY_MODE
+static void FactoryWindowOpen(void);
+void ZCB_FactoryWindowClose(void);
+static void FactoryPoll(void);
+static void FactoryKeyEvent(EVENT_APP event);
+#endif
+#ifdef APP_FEATURE_METER
+static void MeterTick(void);
+static BOOL MeterReportSendNext(void);
+received_frame_status_t handleCommandClassMeter(RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+                                                ZW_APPLICATION_TX_BUFFER *pCmd,
+                                                BYTE cmdLength);
+#endif
+static BOOL RelayReportSendNext(void);
+static void NvmMarkDirty(BYTE flags);
+static void NvmFlush(void);
+static void ConfigApply(void);
+static void ConfigPowerOnApply(void);
+static void SmartStartSeedInit(void);
+static void SmartStartSchedule(void);
+static void SmartStartBegin(void);
+#ifdef APP_FEATURE_CONFIGURATION
+void ZCB_ConfigTextSent(TRANSMISSION_RESULT * pTransmissionResult);
+void ZCB_ConfigTextNext(void);
+received_frame_status_t handleCommandClassConfiguration(RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+                                                        ZW_APPLICATION_TX_BUFFER *pCmd,
+                                                        BYTE cmdLength);
+#endif
+
+void KeyGroupSend(BYTE key, BYTE on);
+static BOOL KeyGroupSendNext(void);
+static void AppRequestSendNext(void);
+void ZCB_AppRequestDone(TRANSMISSION_RESULT * pTransmissionResult);
+void ZCB_AppRequestRetry(void);
+
+#ifdef APP_FEATURE_CENTRAL_SCENE
+static void CentralSceneNotify(BYTE key, BYTE keyAttribute);
+static BOOL CentralSceneSendNext(void);
+static void CentralSceneKeyEvent(BYTE key, BYTE keyEvent);
+static void CentralSceneHoldStop(void);
+void ZCB_CentralSceneWindow(void);
+void ZCB_CentralSceneRefresh(void);
+received_frame_status_t handleCommandClassCentralScene(RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+                                                       ZW_APPLICATION_TX_BUFFER *pCmd,
+                                                       BYTE cmdLength);
+#endif
+
+#ifdef APP_FEATURE_SCENES
+received_frame_status_t handleCommandClassSceneActivation(RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+                                                          ZW_APPLICATION_TX_BUFFER *pCmd,
+                                                          BYTE cmdLength);
+received_frame_status_t handleCommandClassSceneActuatorConf(RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+                                                            ZW_APPLICATION_TX_BUFFER *pCmd,
+                                                            BYTE cmdLength);
+#endif
+
+static received_frame_status_t SendAppResponse(RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+                                               ZW_APPLICATION_TX_BUFFER *pTxBuf,
+                                               BYTE len);
+static received_frame_status_t ResponseCacheSend(RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+                                                 RESPONSE_CACHE_ID id);
+
+#ifdef APP_FEATURE_PROPRIETARY
+received_frame_status_t handleCommandClassManufacturerProprietary(
+                                               RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+                                               ZW_APPLICATION_TX_BUFFER *pCmd,
+                                               BYTE cmdLength);
+#endif
+
+#ifdef APP_FEATURE_CRASH_RING
+static void CrashRingInit(void);
+static void CrashRingEvent(BYTE kind, BYTE value);
+static void CrashRingFlush(BYTE resetCause, VOID_CALLBACKFUNC(pCallback)(void));
+#endif
+void ZCB_AppReset(void);
+#ifdef APP_FEATURE_LINK_STATS
+static LINK_STATS_ENTRY *LinkStatsEntry(APP_NODE_ID nodeId);
+static void LinkStatsTx(APP_NODE_ID nodeId, BYTE txStatus);
+static void LinkStatsRx(APP_NODE_ID nodeId);
+static BOOL LinkAlertSendNext(void);
+#endif
+static void AppReboot(BYTE resetCause);
+static void AppRebootCheck(void);
+static BOOL AppRequestPending(void);
+static void AppRebootNow(void);
+void ZCB_AppRebootDeadline(void);
+
+#ifdef APP_DIAGNOSTICS
+void DiagFrameBegin(void);
+void DiagFrameEnd(BYTE *pFrame, BYTE len);
+void DiagAppEvent(STATE_APP state);
+void DiagPollBegin(void);
+void DiagPollEnd(void);
+void DiagOtaWrite(BYTE len);
+#endif
+
+
+/**
+ * @brief See description for function prototype in ZW_basis_api.h.
+ */
+void
+ApplicationRfNotify(BYTE rfState)
+{
+  UNUSED(rfState);
+}
+
+/*******************************switch************************************/
+//-------------------relay----------------------
+#define relay1_pin_out() SetPinOut(ZDP03A_LED_D1)
+#define relay2_pin_out() SetPinOut(ZDP03A_LED_D2)
+#define relay3_pin_out() SetPinOut(ZDP03A_LED_D3)
+
+#define relay1_on()  Led(ZDP03A_LED_D1,ON)
+#define relay1_off() Led(ZDP03A_LED_D1,OFF)
+#define relay2_on()  Led(ZDP03A_LED_D2,ON)
+#define relay2_off() Led(ZDP03A_LED_D2,OFF)
+#define relay3_on()  Led(ZDP03A_LED_D3,ON)
+#define relay3_off() Led(ZDP03A_LED_D3,OFF)
+
+#define relay_init() \
+	relay1_pin_out(); \
+  relay2_pin_out(); \ 
+  relay3_pin_out(); \
+	relay1_off(); \
+	relay2_off(); \
+	relay3_off()
+
+//-------------------led----------------------
+#define led_nwk_pin_out() SetPinOut(ZDP03A_LED_D6)
+
+#define led_nwk_on()  Led(ZDP03A_LED_D6,ON)
+#define led_nwk_off() Led(ZDP03A_LED_D6,OFF)
+
+#define led_init() \
+   led_nwk_pin_out(); \
+   led_nwk_off()
+
+//-------------------key----------------------
+#define EVENT_KEY1_DOWN            EVENT_KEY_B1_DOWN
+#define EVENT_KEY1_UP              EVENT_KEY_B1_UP
+#define EVENT_KEY1_HELD            EVENT_KEY_B1_HELD
+#define EVENT_KEY1_PRESS           EVENT_KEY_B1_PRESS
+#define EVENT_KEY1_HELD_10_SEC     EVENT_KEY_B1_HELD_10_SEC
+#define EVENT_KEY1_TRIPLE_PRESS    EVENT_KEY_B1_TRIPLE_PRESS
+#define EVENT_KEY2_DOWN            EVENT_KEY_B2_DOWN
+#define EVENT_KEY2_UP              EVENT_KEY_B2_UP
+#define EVENT_KEY2_HELD            EVENT_KEY_B2_HELD
+#define EVENT_KEY2_PRESS           EVENT_KEY_B2_PRESS
+#define EVENT_KEY2_HELD_10_SEC     EVENT_KEY_B2_HELD_10_SEC
+#define EVENT_KEY2_TRIPLE_PRESS    EVENT_KEY_B2_TRIPLE_PRESS
+#define EVENT_KEY3_DOWN            EVENT_KEY_B3_DOWN
+#define EVENT_KEY3_UP              EVENT_KEY_B3_UP
+#define EVENT_KEY3_HELD            EVENT_KEY_B3_HELD
+#define EVENT_KEY3_PRESS           EVENT_KEY_B3_PRESS
+#define EVENT_KEY3_HELD_10_SEC     EVENT_KEY_B3_HELD_10_SEC
+#define EVENT_KEY3_TRIPLE_PRESS    EVENT_KEY_B3_TRIPLE_PRESS
+
+#define key1_pin_in()    SetPinIn(ZDP03A_KEY_1,TRUE) 
+#define key2_pin_in()    SetPinIn(ZDP03A_KEY_2,TRUE)
+#define key3_pin_in()    SetPinIn(ZDP03A_KEY_3,TRUE)
+
+#define key_init() \
+	key1_pin_in(); \
+	key2_pin_in(); \
+	key3_pin_in()
+	
+//-------------------switch----------------------
+typedef struct {
+	BYTE s1:1;
+	BYTE s2:1;
+	BYTE s3:1;
+	BYTE learn:1;
+	BYTE tmr_handle;
+}switch_state_t;
+static switch_state_t switch_state;
+
+#define switch_init() relay_init(); \
+                      led_init(); \
+                      key_init(); \
+                      switch_state.s1 = 0; \
                       switch_state.s2 = 0; \
                       switch_state.s3 = 0
 
-static void s1_state_set(BYTE sta)
+static void s1_state_set(BYTE sta)
+{
+	if(sta) { relay1_on();  switch_state.s1 = 1; }
+	else    { relay1_off(); switch_state.s1 = 0; }
+	RelayChanged(0, sta);
+}
+
+static void s2_state_set(BYTE sta)
+{
+	if(sta) { relay2_on();  switch_state.s2 = 1; }
+	else    { relay2_off(); switch_state.s2 = 0; }
+	RelayChanged(1, sta);
+}
+
+static void s3_state_set(BYTE sta)
+{
+	if(sta) { relay3_on();  switch_state.s3 = 1; }
+	else    { relay3_off(); switch_state.s3 = 0; }
+	RelayChanged(2, sta);
+}
+
+#define s1_state_get() (BYTE)switch_state.s1
+#define s2_state_get() (BYTE)switch_state.s2
+#define s3_state_get() (BYTE)switch_state.s3
+
+//-------------------relays----------------------
+#define RELAY_MASK_ALL 0x07
+
+/* Sets the relays selected in mask to the matching bits of values */
+static void relays_state_set(BYTE mask, BYTE values)
+{
+	if(mask & 0x01) { s1_state_set(values & 0x01); }
+	if(mask & 0x02) { s2_state_set(values & 0x02); }
+	if(mask & 0x04) { s3_state_set(values & 0x04); }
+}
+
+#define relays_state_get() (BYTE)(s1_state_get() | (s2_state_get() << 1) | (s3_state_get() << 2))
+
+void cb_timer_5s(void);
+PCB(cb_timer_5s)(void)
+{
+	ZW_DEBUG_APP_SEND_STR("\ncb_timer_5s()");
+	
+	switch_state.learn = 1;
+#ifdef APP_FEATURE_CENTRAL_SCENE
+	CentralSceneHoldStop();
+#endif
+	if(myNodeID) {
+		ZW_DEBUG_APP_SEND_STR("LEARN_MODE_EXCLUSION");
+		StartLearnModeNow(LEARN_MODE_EXCLUSION_NWE);
+	}
+	else{
+		ZW_DEBUG_APP_SEND_STR("LEARN_MODE_INCLUSION");
+		StartLearnModeNow(LEARN_MODE_INCLUSION);
+	}
+	ChangeState(STATE_APP_LEARN_MODE);
+	led_nwk_on();
+}
+
+
+/**
+ * @brief See description for function prototype in ZW_basis_api.h.
+ */
+BYTE
+ApplicationInitHW(SW_WAKEUP bWakeupReason)
+{
+  wakeupReason = bWakeupReason;
+  /* hardware initialization */
+  ZDP03A_InitHW(ZCB_EventSchedulerEventAdd, NULL);
+	
+  /*SetPinIn(ZDP03A_KEY_1,TRUE);
+  SetPinIn(ZDP03A_KEY_2,TRUE);
+
+	// Learn mode indication
+  SetPinOut(ZDP03A_LED_D1); 
+  Led(ZDP03A_LED_D1,ON);
+  SetPinOut(ZDP03A_LED_D2);
+  Led(ZDP03A_LED_D2,ON);*/
+	
+	switch_init();
+	
+  Transport_OnApplicationInitHW(bWakeupReason);
+
+  return(TRUE);
+}
+
+
+/**
+ * @brief See description for function prototype in ZW_basis_api.h.
+ */
+BYTE
+ApplicationInitSW(ZW_NVM_STATUS nvmStatus)
+{
+  /* Init state machine */
+  currentState = STATE_APP_STARTUP;
+  /* Do not reinitialize the UART if already initialized for ISD51 in ApplicationInitHW() 
+	*/
+#ifndef ZW_ISD51_DEBUG
+  ZW_DEBUG_INIT(1152);
+#endif
+
+  ZW_DEBUG_APP_SEND_STR("\nApplicationInitSW()");
+  ZW_DEBUG_APP_SEND_NUM(wakeupReason);
+  ZW_DEBUG_APP_SEND_NUM(nvmStatus);
+  ZW_DEBUG_APP_SEND_NL();
+
+#ifdef WATCHDOG_ENABLED
+  ZW_WatchDogEnable();
+#endif 
+
+#ifdef APP_FEATURE_CENTRAL_SCENE
+  centralScene.windowTimer = APP_TIMER_NONE;
+  centralScene.refreshTimer = APP_TIMER_NONE;
+#endif
+  TimerWheelInit();
+
+  /* Signal that the sensor is awake */
+  LoadConfiguration(nvmStatus);
+#ifdef APP_FEATURE_CRASH_RING
+  CrashRingInit();
+#endif
+
+  /* Setup AGI group lists */
+  AGI_Init();
+  AGI_LifeLineGroupSetup(agiTableLifeLine, (sizeof(agiTableLifeLine)/sizeof(CMD_CLASS_GRP)), GroupName, ENDPOINT_ROOT);
+  AGI_ResourceGroupSetup(agiTableKeyGroups, NUMBER_OF_KEY_GROUPS, ENDPOINT_ROOT);
+
+#ifdef BOOTLOADER_ENABLED
+  /* Initialize OTA module */
+    OtaInit( ZCB_OTAStart, NULL, ZCB_OTAFinish);
+#endif
+
+  /* Initialize Event Scheduler */
+  EventSchedulerInit(AppStateManager);
+
+  Transport_OnApplicationInitSW( &m_AppNIF, NULL);
+
+  /* Init state machine */
+  ZCB_EventSchedulerEventAdd((EVENT_WAKEUP)wakeupReason);
+
+  return(TRUE);
+}
+
+
+/**
+ * @brief See description for function prototype in ZW_basis_api.h.
+ */
+void
+ApplicationTestPoll(void)
+{
+}
+
+
+/**
+ * @brief See description for function prototype in ZW_basis_api.h.
+ */
+void
+ApplicationPoll(void)
+{
+#ifdef WATCHDOG_ENABLED
+  ZW_WatchDogKick(); 
+#endif
+
+  DIAG_POLL_BEGIN();
+  TaskApplicationPoll();
+#ifdef APP_FACTORY_MODE
+  FactoryPoll();
+#endif
+  DIAG_POLL_END();
+}
+
+
+/**
+ * @brief See description for function prototype in ZW_TransportEndpoint.h.
+ */
+received_frame_status_t
+Transport_ApplicationCommandHandlerEx(
+  RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+  ZW_APPLICATION_TX_BUFFER *pCmd,
+  BYTE cmdLength)
+{
+  received_frame_status_t frame_status = RECEIVED_FRAME_STATUS_NO_SUPPORT;
+  ZW_DEBUG_APP_SEND_NL();
+  ZW_DEBUG_APP_SEND_STR("\nTransport_ApplicationCommandHandlerEx()");
+  ZW_DEBUG_APP_SEND_NUM(pCmd->ZW_Common.cmdClass);
+  DIAG_FRAME_BEGIN();
+#ifdef APP_FEATURE_CRASH_RING
+  CrashRingEvent(CRASH_EVENT_FRAME, pCmd->ZW_Common.cmdClass);
+#endif
+#ifdef APP_FEATURE_LINK_STATS
+  LinkStatsRx(rxOpt->sourceNode.nodeId);
+#endif
+  rxFrameInProgress = TRUE;
+  if (rxOpt->rxStatus & (RECEIVE_STATUS_TYPE_BROAD | RECEIVE_STATUS_TYPE_MULTI))
+  {
+    GroupcastReceived(rxOpt);
+  }
+  else
+  {
+    rxFromLifeline = AssocIsOnlyMember(ASSOC_GROUP_LIFELINE, rxOpt->sourceNode.nodeId);
+  }
+
+  /* Call command class handlers */
+  switch (pCmd->ZW_Common.cmdClass)
+  {
+    case COMMAND_CLASS_VERSION:
+			ZW_DEBUG_APP_SEND_STR("->VERSION");
+      frame_status = handleCommandClassVersion(rxOpt, pCmd, cmdLength);
+      break;
+
+#ifdef BOOTLOADER_ENABLED
+    case COMMAND_CLASS_FIRMWARE_UPDATE_MD_V2:
+			ZW_DEBUG_APP_SEND_STR("\n->MD_V2");
+      frame_status = handleCommandClassFWUpdate(rxOpt, pCmd, cmdLength);
+      break;
+#endif
+
+    case COMMAND_CLASS_ASSOCIATION_GRP_INFO:
+			ZW_DEBUG_APP_SEND_STR("\n->INFO");
+      frame_status = handleCommandClassAssociationGroupInfo( rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_ASSOCIATION:
+			ZW_DEBUG_APP_SEND_STR("\n->ASSOCIATION");
+			frame_status = handleCommandClassAssociation(rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_POWERLEVEL:
+			ZW_DEBUG_APP_SEND_STR("\n->POWERLEVEL");
+      frame_status = handleCommandClassPowerLevel(rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_MANUFACTURER_SPECIFIC:
+			ZW_DEBUG_APP_SEND_STR("\n->SPECIFIC");
+      if ((MANUFACTURER_SPECIFIC_GET == pCmd->ZW_Common.cmd) &&
+          (ENDPOINT_ROOT == rxOpt->destNode.endpoint) &&
+          (FALSE == Check_not_legal_response_job(rxOpt)))
+      {
+        frame_status = ResponseCacheSend(rxOpt, RESPONSE_CACHE_MANUFACTURER_SPECIFIC);
+        break;
+      }
+      frame_status = handleCommandClassManufacturerSpecific(rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_ZWAVEPLUS_INFO:
+			ZW_DEBUG_APP_SEND_STR("\n->ZWAVEPLUS_INFO");
+      if ((ZWAVEPLUS_INFO_GET == pCmd->ZW_Common.cmd) &&
+          (ENDPOINT_ROOT == rxOpt->destNode.endpoint) &&
+          (FALSE == Check_not_legal_response_job(rxOpt)))
+      {
+        frame_status = ResponseCacheSend(rxOpt, RESPONSE_CACHE_ZWAVEPLUS_INFO);
+        break;
+      }
+      frame_status = handleCommandClassZWavePlusInfo(rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_BASIC:
+			ZW_DEBUG_APP_SEND_STR("\n->BASIC");
+      frame_status = handleCommandClassBasic(rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_SWITCH_BINARY:
+			ZW_DEBUG_APP_SEND_STR("\n->BINARY");
+      if ((SWITCH_BINARY_SET_V2 == pCmd->ZW_Common.cmd) &&
+          (cmdLength >= sizeof(ZW_SWITCH_BINARY_SET_V2_FRAME)) &&
+          DurationToSeconds(pCmd->ZW_SwitchBinarySetV2Frame.duration))
+      {
+        frame_status = BinarySwitchSetTimed(rxOpt->destNode.endpoint,
+                                            pCmd->ZW_SwitchBinarySetV2Frame.targetValue,
+                                            pCmd->ZW_SwitchBinarySetV2Frame.duration);
+        break;
+      }
+      frame_status = handleCommandClassBinarySwitch(rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_SWITCH_ALL:
+			ZW_DEBUG_APP_SEND_STR("\n->SWITCH_ALL");
+      frame_status = handleCommandClassSwitchAll(rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_SUPERVISION:
+			ZW_DEBUG_APP_SEND_STR("\n->SUPERVISION");
+      frame_status = handleCommandClassSupervision(rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_MULTI_CHANNEL_ASSOCIATION_V2:
+			ZW_DEBUG_APP_SEND_STR("\n->ASSOCIATION_V2");
+      frame_status = handleCommandClassMultiChannelAssociation(rxOpt, pCmd, cmdLength);
+      break;
+
+#ifdef APP_FEATURE_CENTRAL_SCENE
+    case COMMAND_CLASS_CENTRAL_SCENE:
+      ZW_DEBUG_APP_SEND_STR("\n->CENTRAL_SCENE");
+      frame_status = handleCommandClassCentralScene(rxOpt, pCmd, cmdLength);
+      break;
+#endif
+
+#ifdef APP_FEATURE_SCENES
+    case COMMAND_CLASS_SCENE_ACTIVATION:
+      ZW_DEBUG_APP_SEND_STR("\n->SCENE_ACTIVATION");
+      frame_status = handleCommandClassSceneActivation(rxOpt, pCmd, cmdLength);
+      break;
+
+    case COMMAND_CLASS_SCENE_ACTUATOR_CONF:
+      ZW_DEBUG_APP_SEND_STR("\n->SCENE_ACTUATOR_CONF");
+      frame_status = handleCommandClassSceneActuatorConf(rxOpt, pCmd, cmdLength);
+      break;
+#endif
+
+#ifdef APP_FEATURE_CONFIGURATION
+    case COMMAND_CLASS_CONFIGURATION:
+      ZW_DEBUG_APP_SEND_STR("\n->CONFIGURATION");
+      frame_status = handleCommandClassConfiguration(rxOpt, pCmd, cmdLength);
+      break;
+#endif
+
+#ifdef APP_FEATURE_METER
+    case COMMAND_CLASS_METER:
+      ZW_DEBUG_APP_SEND_STR("\n->METER");
+      frame_status = handleCommandClassMeter(rxOpt, pCmd, cmdLength);
+      break;
+#endif
+
+#ifdef APP_FEATURE_PROPRIETARY
+    case COMMAND_CLASS_MANUFACTURER_PROPRIETARY:
+      ZW_DEBUG_APP_SEND_STR("\n->PROPRIETARY");
+      frame_status = handleCommandClassManufacturerProprietary(rxOpt, pCmd, cmdLength);
+      break;
+#endif
+  }
+  rxFrameInProgress = FALSE;
+  rxFromLifeline = FALSE;
+  DIAG_FRAME_END((BYTE *)pCmd, cmdLength);
+  return frame_status;
+}
+
+
+/**
+ * @brief See description for function prototype in CommandClassVersion.h.
+ */
+BYTE
+handleCommandClassVersionAppl( BYTE cmdClass )
+{
+  BYTE commandClassVersion = UNKNOWN_VERSION;
+  ZW_DEBUG_APP_SEND_STR("\nhandleCommandClassVersionAppl()");
+  switch (cmdClass)
+  {
+    case COMMAND_CLASS_VERSION:
+			ZW_DEBUG_APP_SEND_STR("\n->VERSION");
+      commandClassVersion = CommandClassVersionVersionGet();
+      break;
+
+#ifdef BOOTLOADER_ENABLED
+    case COMMAND_CLASS_FIRMWARE_UPDATE_MD:
+			ZW_DEBUG_APP_SEND_STR("\n->MD");
+      commandClassVersion = CommandClassFirmwareUpdateMdVersionGet();
+      break;
+#endif
+
+    case COMMAND_CLASS_POWERLEVEL:
+			ZW_DEBUG_APP_SEND_STR("\n->POWERLEVEL");
+      commandClassVersion = CommandClassPowerLevelVersionGet();
+      break;
+
+    case COMMAND_CLASS_MANUFACTURER_SPECIFIC:
+			ZW_DEBUG_APP_SEND_STR("\n->SPECIFIC");
+      commandClassVersion = CommandClassManufacturerVersionGet();
+      break;
+
+    case COMMAND_CLASS_ASSOCIATION:
+			ZW_DEBUG_APP_SEND_STR("\n->ASSOCIATION");
+     commandClassVersion = CommandClassAssociationVersionGet();
+      break;
+
+    case COMMAND_CLASS_ASSOCIATION_GRP_INFO:
+			ZW_DEBUG_APP_SEND_STR("\n->INFO");
+     commandClassVersion = CommandClassAssociationGroupInfoVersionGet();
+      break;
+
+    case COMMAND_CLASS_DEVICE_RESET_LOCALLY:
+			ZW_DEBUG_APP_SEND_STR("\n->LOCALLY");
+     commandClassVersion = CommandClassDeviceResetLocallyVersionGet();
+      break;
+
+    case COMMAND_CLASS_ZWAVEPLUS_INFO:
+			ZW_DEBUG_APP_SEND_STR("\n->ZWAVEPLUS_INFO");
+     commandClassVersion = CommandClassZWavePlusVersion();
+      break;
+    case COMMAND_CLASS_BASIC:
+			ZW_DEBUG_APP_SEND_STR("\n->BASIC");
+     commandClassVersion =  CommandClassBasicVersionGet();
+      break;
+    case COMMAND_CLASS_SWITCH_BINARY:
+			ZW_DEBUG_APP_SEND_STR("\n->BINARY");
+     commandClassVersion = CommandClassBinarySwitchVersionGet();
+      break;
+
+    case COMMAND_CLASS_SWITCH_ALL:
+			ZW_DEBUG_APP_SEND_STR("\n->SWITCH_ALL");
+     commandClassVersion = CommandClassSwitchAllVersionGet();
+      break;
+
+    case COMMAND_CLASS_MULTI_CHANNEL_ASSOCIATION_V2:
+			ZW_DEBUG_APP_SEND_STR("\n->ASSOCIATION_V2");
+      commandClassVersion = CmdClassMultiChannelAssociationVersion();
+      break;
+
+    case COMMAND_CLASS_SUPERVISION:
+			ZW_DEBUG_APP_SEND_STR("\n->SUPERVISION");
+      commandClassVersion = CommandClassSupervisionVersionGet();
+      break;
+
+#ifdef APP_FEATURE_CENTRAL_SCENE
+    case COMMAND_CLASS_CENTRAL_SCENE:
+      ZW_DEBUG_APP_SEND_STR("\n->CENTRAL_SCENE");
+      commandClassVersion = CENTRAL_SCENE_VERSION_V3;
+      break;
+#endif
+
+#ifdef APP_FEATURE_SCENES
+    case COMMAND_CLASS_SCENE_ACTIVATION:
+      ZW_DEBUG_APP_SEND_STR("\n->SCENE_ACTIVATION");
+      commandClassVersion = SCENE_ACTIVATION_VERSION;
+      break;
+
+    case COMMAND_CLASS_SCENE_ACTUATOR_CONF:
+      ZW_DEBUG_APP_SEND_STR("\n->SCENE_ACTUATOR_CONF");
+      commandClassVersion = SCENE_ACTUATOR_CONF_VERSION;
+      break;
+#endif
+
+#ifdef APP_FEATURE_CONFIGURATION
+    case COMMAND_CLASS_CONFIGURATION:
+      ZW_DEBUG_APP_SEND_STR("\n->CONFIGURATION");
+      commandClassVersion = CONFIGURATION_VERSION_V4;
+      break;
+#endif
+
+#ifdef APP_FEATURE_METER
+    case COMMAND_CLASS_METER:
+      ZW_DEBUG_APP_SEND_STR("\n->METER");
+      commandClassVersion = METER_VERSION_V3;
+      break;
+#endif
+
+    default:
+			ZW_DEBUG_APP_SEND_STR("\n->default");
+     commandClassVersion = ZW_Transport_CommandClassVersionGet(cmdClass);
+  }
+  return commandClassVersion;
+}
+
+
+/**
+ * @brief See description for function prototype in ZW_slave_api.h.
+ */
+void
+ApplicationSlaveUpdate(
+  BYTE bStatus,
+  BYTE bNodeID,
+  BYTE* pCmd,
+  BYTE bLen)
+{
+  UNUSED(bStatus);
+  UNUSED(bNodeID);
+  UNUSED(pCmd);
+  UNUSED(bLen);
+}
+
+
+/**
+ * @brief See description for function prototype in slave_learn.h.
+ */
+void
+LearnCompleted(BYTE bNodeID)
+{
+  ZW_DEBUG_APP_SEND_NL();
+  ZW_DEBUG_APP_SEND_STR("LearnCompleted()");
+  ZW_DEBUG_APP_SEND_NUM(bNodeID);
+  /*If bNodeID= 0xff.. learn mode failed*/
+  if(bNodeID != NODE_BROADCAST)
+  {
+    /*Success*/
+    myNodeID = bNodeID;
+    if (0 != myNodeID)
+    {
+      /* Included, a later exclusion starts over with a short delay */
+      TimerWheelCancel(&smartStartHandle);
+      smartStartWindow = SMARTSTART_WINDOW_MIN;
+    }
+    if (0 == myNodeID)
+    {
+      /*Clear association*/
+      AssociationInit(TRUE);
+      SetDefaultConfiguration();
+    }
+  }
+  ZCB_EventSchedulerEventAdd((EVENT_APP) EVENT_SYSTEM_LEARNMODE_FINISH);
+  Transport_OnLearnCompleted(bNodeID);
+}
+
+
+/**
+ * @brief Returns the Z-Wave node ID.
+ * @return BYTE NodeID
+ */
+BYTE
+GetMyNodeID(void)
+{
+	return myNodeID;
+}
+
+
+/**
+ * @brief Returns the current state of the application state machine.
+ * @return Current state
+ */
+STATE_APP
+GetAppState(void)
+{
+  return currentState;
+}
+
+/**
+ * @brief The core state machine of this sample application.
+ * @param event The event that triggered the call of AppStateManager.
+ */
+void
+AppStateManager(EVENT_APP event)
+{
+  ZW_DEBUG_APP_SEND_NL();
+  ZW_DEBUG_APP_SEND_STR("AppStateManager()");
+  ZW_DEBUG_APP_SEND_NUM(event);
+  ZW_DEBUG_APP_SEND_STR("s");
+  ZW_DEBUG_APP_SEND_NUM(currentState);
+  DIAG_APP_EVENT(currentState);
+#ifdef APP_FEATURE_CRASH_RING
+  CrashRingEvent(CRASH_EVENT_APP, event);
+#endif
+
+  if(EVENT_SYSTEM_WATCHDOG_RESET == event)
+  {
+    /*Force state change to activate watchdog-reset without taking care of current
+      state.*/
+    ChangeState(STATE_APP_WATCHDOG_RESET);
+  }
+
+  switch(currentState)
+  {
+    case STATE_APP_STARTUP:
+			ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_STARTUP");
+      ConfigPowerOnApply();
+      ChangeState(STATE_APP_IDLE);
+#ifdef APP_FACTORY_MODE
+      FactoryWindowOpen();
+#endif
+      SmartStartSeedInit();
+      SmartStartSchedule();
+      break;
+
+    case STATE_APP_IDLE:
+			ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_IDLE");
+		  if(event == EVENT_SYSTEM_LEARNMODE_START) {
+					if(myNodeID) {
+						ZW_DEBUG_APP_SEND_STR("LEARN_MODE_EXCLUSION");
+						StartLearnModeNow(LEARN_MODE_EXCLUSION_NWE);
+					}
+					else{
+						ZW_DEBUG_APP_SEND_STR("LEARN_MODE_INCLUSION");
+						StartLearnModeNow(LEARN_MODE_INCLUSION);
+					}
+					ChangeState(STATE_APP_LEARN_MODE);
+					led_nwk_on();
+					return;
+      }
+			else if(event == EVENT_KEY1_DOWN || 
+							event == EVENT_KEY2_DOWN || 
+						  event == EVENT_KEY3_DOWN) { 
+				ZW_DEBUG_APP_SEND_STR("\nEVENT_KEY_DOWN"); 
+				switch_state.tmr_handle = ZW_TIMER_START(cb_timer_5s,500,1); //500*10=5s
+				switch_state.learn = 0;
+#ifdef APP_FEATURE_CENTRAL_SCENE
+				CentralSceneKeyEvent((event == EVENT_KEY1_DOWN) ? 0 : ((event == EVENT_KEY2_DOWN) ? 1 : 2),
+				                     KEY_GESTURE_DOWN);
+#endif
+			}
+			else if(event == EVENT_KEY1_HELD || 
+							event == EVENT_KEY2_HELD || 
+						  event == EVENT_KEY3_HELD) { 
+				ZW_DEBUG_APP_SEND_STR("\nEVENT_KEY_HELD"); 
+#ifdef APP_FEATURE_CENTRAL_SCENE
+				CentralSceneKeyEvent((event == EVENT_KEY1_HELD) ? 0 : ((event == EVENT_KEY2_HELD) ? 1 : 2),
+				                     KEY_GESTURE_HELD);
+#endif
+			}
+			else if(event == EVENT_KEY1_UP) { 
+				ZW_DEBUG_APP_SEND_STR("\nEVENT_KEY1_UP"); 
+				if(switch_state.learn == 0) {
+					ZW_TIMER_CANCEL(switch_state.tmr_handle);
+					KeyPressed(0);
+				}
+			}
+			else if(event == EVENT_KEY2_UP) { 
+				ZW_DEBUG_APP_SEND_STR("\nEVENT_KEY2_UP"); 
+				if(switch_state.learn == 0) {
+					ZW_TIMER_CANCEL(switch_state.tmr_handle);
+					KeyPressed(1);
+				}
+			}
+			else if(event == EVENT_KEY3_UP) { 
+				ZW_DEBUG_APP_SEND_STR("\nEVENT_KEY3_UP"); 
+				if(switch_state.learn == 0) {
+					ZW_TIMER_CANCEL(switch_state.tmr_handle);
+					KeyPressed(2);
+				}
+			}
+      break;
+
+    case STATE_APP_LEARN_MODE:
+			ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_LEARN_MODE");
+		  if(event == EVENT_SYSTEM_LEARNMODE_END) {
+				ZW_DEBUG_APP_SEND_STR("\nEVENT_SYSTEM_LEARNMODE_END");
+				StartLearnModeNow(LEARN_MODE_DISABLE);
+        ChangeState(STATE_APP_IDLE);
+				led_nwk_off();
+				SmartStartSchedule();
+			}
+      else if(event == EVENT_SYSTEM_LEARNMODE_FINISH) {
+        ZW_DEBUG_APP_SEND_STR("\nEVENT_SYSTEM_LEARNMODE_FINISH");
+        ChangeState(STATE_APP_IDLE);
+				led_nwk_off();
+				SmartStartSchedule();
+      }
+      break;
+
+    case STATE_APP_WATCHDOG_RESET:
+      ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_WATCHDOG_RESET");
+      if (EVENT_SYSTEM_WATCHDOG_RESET == event)
+      {
+        AppReboot(CRASH_CAUSE_APP_RESET);
+      }
+      break;
+
+#ifdef APP_FACTORY_MODE
+    case STATE_APP_FACTORY:
+      FactoryKeyEvent(event);
+      break;
+#endif
+
+#ifdef BOOTLOADER_ENABLED
+    case STATE_APP_OTA_HOST:
+		  ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_OTA_HOST");
+      if(EVENT_APP_OTA_HOST_WRITE_DONE == event)
+      {
+        ZW_DEBUG_APP_SEND_STR("\nEVENT_APP_OTA_HOST_WRITE_DONE");
+        OtaHostFWU_WriteFinish();
+      }
+      if(EVENT_APP_OTA_HOST_STATUS == event)
+      {
+        ZW_DEBUG_APP_SEND_STR("\nEVENT_APP_OTA_HOST_STATUS");
+        userReboot = FALSE;
+        OtaHostFWU_Status(userReboot, TRUE);
+      }
+      break;
+#endif
+  }
+}
+
+
+/**
+ * @brief Sets the current state to a new, given state.
+ * @param newState New state.
+ */
+static void
+ChangeState(STATE_APP newState)
+{
+  ZW_DEBUG_APP_SEND_STR("\nChangeState(");
+  ZW_DEBUG_APP_SEND_NUM(newState);
+	ZW_DEBUG_APP_SEND_STR(")");
+
+  currentState = newState;
+#ifdef APP_FEATURE_CRASH_RING
+  /* State changes are rare and tell most about a later lockup */
+  CrashRingEvent(CRASH_EVENT_STATE, newState);
+  NvmMarkDirty(NVM_DIRTY_CRASH);
+#endif
+}
+
+/**
+ * @brief Transmission callback for Device Reset Locally call.
+ * @param pTransmissionResult Result of each transmission.
+ */
+PCB(ZCB_DeviceResetLocallyDone)(TRANSMISSION_RESULT * pTransmissionResult)
+{
+	ZW_DEBUG_APP_SEND_STR("\nZCB_DeviceResetLocallyDone()");
+	
+  if (TRANSMISSION_RESULT_FINISHED == pTransmissionResult->isFinished)
+  {
+    ZW_DEBUG_APP_SEND_NL();
+    ZW_DEBUG_APP_SEND_STR("DRLD");
+
+    ZCB_EventSchedulerEventAdd((EVENT_APP) EVENT_SYSTEM_WATCHDOG_RESET);
+  }
+}
+
+#ifdef BOOTLOADER_ENABLED
+/**
+ * @brief Called when OTA firmware upgrade is finished. Reboots node to cleanup
+ * and starts on new FW.
+ * @param OTA_STATUS otaStatus
+ */
+PCB(ZCB_OTAFinish)(OTA_STATUS otaStatus)
+{
+	ZW_DEBUG_APP_SEND_STR("\nZCB_OTAFinish()");
+	
+  UNUSED(otaStatus);
+  otaActive = FALSE;
+  if (STATE_APP_OTA_HOST == GetAppState())
+  {
+    ChangeState(STATE_APP_IDLE);
+    if (userReboot)
+    {
+      userReboot = FALSE;
+      return;
+    }
+  }
+  if (OTA_STATUS_DONE == otaStatus)
+  {
+  /*Just reboot node to cleanup and start on new FW.*/
+    AppReboot(CRASH_CAUSE_OTA);
+  }
+  else
+  {
+    /* Release the reports held during the update */
+    AppRequestSendNext();
+  }
+}
+
+
+/**
+ * @brief Function pointer for KEIL.
+ */
+code const BOOL (code * ZCB_OTAStart_p)(void) = &ZCB_OTAStart;
+/**
+ * @brief Called before OTA firmware upgrade starts.
+ * @details Checks whether the application is ready for a firmware upgrade.
+ * @return FALSE if OTA should be rejected, otherwise TRUE.
+ */
+BOOL
+ZCB_OTAStart(void)
+{
+  BOOL  status = FALSE;
+	
+	ZW_DEBUG_APP_SEND_STR("\nZCB_OTAStart()");
+	
+  if (STATE_APP_IDLE == GetAppState())
+  {
+    ZCB_EventSchedulerEventAdd((EVENT_APP) EVENT_SYSTEM_OTA_START);
+    otaActive = TRUE;
+    status = TRUE;
+  }
+  return status;
+}
+
+
+/**
+ * @brief Called OTA firmware upgrade want to write an image
+ * @param BYTE *pData pointer to the image data to write.
+ * @param BYTE len length of the image data
+ */
+PCB(ZCB_OTAWrite)(BYTE *pData, BYTE len)
+{
+  static WORD adr = 0;
+	
+	ZW_DEBUG_APP_SEND_STR("\nZCB_OTAWrite()");
+	
+  UNUSED(pData);
+  if (STATE_APP_IDLE == GetAppState())
+  {
+    ZW_DEBUG_APP_SEND_NL();
+    ZW_DEBUG_APP_SEND_STR("STATE_APP_OTA_HOST");
+
+    ChangeState(STATE_APP_OTA_HOST);
+  }
+  if (len)
+  {
+    DIAG_OTA_WRITE(len);
+    ZW_DEBUG_APP_SEND_STR("W ADR: 0x");
+    ZW_DEBUG_APP_SEND_NUM((BYTE)(adr>>8) & 0xFF);
+    ZW_DEBUG_APP_SEND_NUM((BYTE)(adr & 0x00FF));
+    ZW_DEBUG_APP_SEND_STR(" L: 0x");
+    ZW_DEBUG_APP_SEND_NUM(len);
+    ZW_DEBUG_APP_SEND_BYTE(':');
+
+    adr += len;
+    while(--len)
+    {
+      ZW_DEBUG_APP_SEND_NUM(*pData++);
+    }
+    ZW_DEBUG_APP_SEND_NL();
+    // set event write finish
+    ZCB_EventSchedulerEventAdd(EVENT_APP_OTA_HOST_WRITE_DONE);
+
+  }
+  else
+  {
+    // set event ota host status
+    ZCB_EventSchedulerEventAdd(EVENT_APP_OTA_HOST_STATUS);
+  }
+
+}
+#endif
+
+
+/**
+ * @brief Handler for basic set.
+ *
+ * Handles received basic set commands.
+ *
+ * @param val Parameter dependent of the application device class.
+ */
+void
+handleBasicSetCommand(BYTE val, BYTE endpoint )
+{
+  CommandClassBinarySwitchSupportSet(val, endpoint);
+}
+
+
+/**
+ * @brief Handler for basic get. Handles received basic get commands.
+ */
+BYTE
+getAppBasicReport( BYTE endpoint )
+{
+  return handleAppltBinarySwitchGet(endpoint);
+}
+
+
+/**
+ * @brief Report the target value
+ * @return target value.
+ */
+BYTE
+getAppBasicReportTarget( BYTE endpoint )
+{
+  if ((endpoint < RELAY_COUNT) && (TIMER_WHEEL_NONE != relayTimers.transition[endpoint]))
+  {
+    return relayTimers.target[endpoint];
+  }
+  return handleAppltBinarySwitchGet(endpoint);
+}
+
+
+/**
+ * @brief Report transition duration time.
+ * @return duration time.
+ */
+BYTE
+getAppBasicReportDuration( BYTE endpoint )
+{
+  if ((endpoint < RELAY_COUNT) && (TIMER_WHEEL_NONE != relayTimers.transition[endpoint]))
+  {
+    return SecondsToDuration(TimerWheelRemaining(relayTimers.transition[endpoint]));
+  }
+  return 0;
+}
+
+/**
+ * @brief See description for function prototype in CommandClassSwitchAll.h.
+ */ 
+void handleSwitchAll(CMD_CLASS_SWITCHALL_SET val, BYTE endpoint)
+{
+	UNUSED(endpoint);
+	relays_state_set(RELAY_MASK_ALL, val ? RELAY_MASK_ALL : 0);
+}
+
+
+/**
+ * @brief See description for function prototype in CommandClassVersion.h.
+ */
+BYTE
+handleNbrFirmwareVersions(void)
+{
+  return 1; /*CHANGE THIS - firmware 0 version*/
+}
+
+
+/**
+ * @brief See description for function prototype in CommandClassVersion.h.
+ */
+void
+handleGetFirmwareVersion(
+        BYTE bFirmwareNumber,
+        VG_VERSION_REPORT_V2_VG* pVariantgroup)
+{
+  /*firmware 0 version and sub version*/
+	ZW_DEBUG_APP_SEND_STR("\nhandleGetFirmwareVersion()");
+	
+  if(bFirmwareNumber == 0)
+  {
+    pVariantgroup->firmwareVersion = APP_VERSION;
+    pVariantgroup->firmwareSubVersion = APP_REVISION;
+  }
+  else
+  {
+    /*Just set it to 0 if firmware n is not present*/
+    pVariantgroup->firmwareVersion = 0;
+    pVariantgroup->firmwareSubVersion = 0;
+  }
+}
+
+
+/**
+ * Function return firmware Id of target n (0 => is device FW ID)
+ * n read version of firmware number n (0,1..N-1)
+ * @return firmaware ID.
+ */
+WORD
+handleFirmWareIdGet( BYTE n)
+{
+	ZW_DEBUG_APP_SEND_STR("\nhandleFirmWareIdGet()");
+	
+  if(n == 0)
+  {
+    return APP_FIRMWARE_ID;
+  }
+  else if (n == 1)
+  {
+    return 0x1234;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief See description for function prototype in CommandClassBianrySwitch.h
+ */
+BYTE
+handleAppltBinarySwitchGet(BYTE endpoint)
+{
+	if(endpoint == 0) {
+		return s1_state_get();
+	}
+	else if(endpoint == 1) {
+		return s2_state_get();
+	}
+	else if(endpoint == 2) {
+		return s3_state_get();
+	}
+	return 0;
+}
+
+
+/**
+ * @brief See description for function prototype in CommandClassBianrySwitch.h
+ */
+void
+handleApplBinarySwitchSet(CMD_CLASS_BIN_SW_VAL val, BYTE endpoint )
+{
+	if(endpoint == 0) {
+		s1_state_set(val);
+	}
+	else if(endpoint == 1) {
+		s2_state_set(val);
+	}
+	else if(endpoint == 2) {
+		s3_state_set(val);
+	}
+}
+
+
+/**
+ * @brief Handles a Binary Switch Set with a duration: the relay is switched
+ * when the duration has passed.
+ * @details If the timer wheel is full the relay is switched at once, so
+ * the Set is never lost.
+ * @param relay Relay index, the destination endpoint.
+ * @param value Target value, 0x00 off, 0x01 to 0x63 or 0xFF on.
+ * @param duration Duration field of the Set, not 0.
+ * @return RECEIVED_FRAME_STATUS_FAIL for an unknown relay or value.
+ */
+static received_frame_status_t
+BinarySwitchSetTimed(BYTE relay, BYTE value, BYTE duration)
+{
+  CMD_CLASS_BIN_SW_VAL val;
+
+  if ((relay >= RELAY_COUNT) || ((value > 0x63) && (0xFF != value)))
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
+  val = value ? CMD_CLASS_BIN_ON : CMD_CLASS_BIN_OFF;
+  TimerWheelCancel(&relayTimers.transition[relay]);
+  relayTimers.target[relay] = value ? 1 : 0;
+  relayTimers.transition[relay] =
+    TimerWheelInsert(DurationToSeconds(duration),
+                     TW_ACTION_TRANSITION | (value ? TW_ACTION_ON : 0) | relay);
+  if (TIMER_WHEEL_NONE == relayTimers.transition[relay])
+  {
+    handleApplBinarySwitchSet(val, relay);
+  }
+  return RECEIVED_FRAME_STATUS_SUCCESS;
+}
+
+
+/**
+ * @brief Sets the configuration to default values and saves it to EEPROM.
+ */
+void
+SetDefaultConfiguration(void)
+{
+  BYTE i;
+
+	ZW_DEBUG_APP_SEND_STR("\nSetDefaultConfiguration()");
+	
+  /* Mark stored configuration as OK */
+  MemoryPutByte((WORD)&OnOffState_far, 0);
+  MemoryPutByte((WORD)&EEOFFSET_MAGIC_far, APPL_MAGIC_VALUE);
+  MemoryPutByte((WORD)&EEOFFSET_APP_far.layout, APP_NVM_LAYOUT);
+  MemoryPutByte( (WORD)&EEOFFSET_SWITCH_ALL_MODE_far[0],
+    SWITCH_ALL_REPORT_INCLUDED_IN_THE_ALL_ON_ALL_OFF_FUNCTIONALITY);
+#ifdef APP_FEATURE_CENTRAL_SCENE
+  centralScene.slowRefresh = TRUE;
+  MemoryPutByte((WORD)&EEOFFSET_APP_far.centralSceneSlowRefresh, centralScene.slowRefresh);
+#endif
+#ifdef APP_FEATURE_SCENES
+  /* No scene configured */
+  memset(sceneIndex, 0, sizeof(sceneIndex));
+  MemoryPutBuffer((WORD)&EEOFFSET_APP_far.sceneIndex[0], sceneIndex, sizeof(sceneIndex), NULL);
+#endif
+  for (i = 0; i < CONFIG_PARAM_COUNT; i++)
+  {
+    configValues[i] = configParamInfo[i].defaultValue;
+  }
+  MemoryPutBuffer((WORD)&EEOFFSET_APP_far.configParams[0], (BYTE *)configValues, sizeof(configValues), NULL);
+  ConfigApply();
+#ifdef APP_FEATURE_METER
+  memset((BYTE *)meter, 0, sizeof(meter));
+  nvmDirty |= NVM_DIRTY_METER;
+  NvmFlush();
+#endif
+}
+
+
+/**
+ * @brief Loads configuration from EEPROM. If no configuration is stored,
+ * default values are loaded and then saved to EEPROM.
+ */
+void
+LoadConfiguration(ZW_NVM_STATUS nvmStatus)
+{
+  uint8_t magicValue;
+#ifdef APP_FEATURE_METER
+  BYTE i;
+#endif
+
+	ZW_DEBUG_APP_SEND_STR("\nLoadConfiguration()");
+	
+  /* Get this sensors identification on the network */
+  MemoryGetID( NULL, &myNodeID);
+  ManufacturerSpecificDeviceIDInit();
+#ifdef BOOTLOADER_ENABLED
+  NvmInit(nvmStatus);
+#else
+  UNUSED(nvmStatus);
+#endif
+  /* Check to see, if any valid configuration is stored in the EEPROM */
+  magicValue = MemoryGetByte((WORD)&EEOFFSET_MAGIC_far);
+  ZW_DEBUG_APP_SEND_NL();
+  ZW_DEBUG_APP_SEND_BYTE('M');
+  ZW_DEBUG_APP_SEND_NUM(magicValue);
+  if ((APPL_MAGIC_VALUE == magicValue) &&
+      (APP_NVM_LAYOUT != MemoryGetByte((WORD)&EEOFFSET_APP_far.layout)))
+  {
+    /* Stored by firmware with another layout or feature set. The node
+     * stays in the network, only the application settings start over. */
+    ZW_DEBUG_APP_SEND_STR("\nNVM layout");
+    loadStatusPowerLevel(NULL,NULL);
+    SetDefaultConfiguration();
+    AssociationInit(FALSE);
+  }
+  else if (APPL_MAGIC_VALUE == magicValue)
+  {
+    loadStatusPowerLevel(NULL,NULL);
+    /* There is a configuration stored, so load it */
+#ifdef APP_FEATURE_CENTRAL_SCENE
+    /* Slow refresh is on unless explicitly turned off */
+    centralScene.slowRefresh =
+      (FALSE == MemoryGetByte((WORD)&EEOFFSET_APP_far.centralSceneSlowRefresh)) ? FALSE : TRUE;
+#endif
+#ifdef APP_FEATURE_SCENES
+    MemoryGetBuffer((WORD)&EEOFFSET_APP_far.sceneIndex[0], sceneIndex, sizeof(sceneIndex));
+#endif
+    MemoryGetBuffer((WORD)&EEOFFSET_APP_far.configParams[0], (BYTE *)configValues, sizeof(configValues));
+    ConfigApply();
+#ifdef APP_FEATURE_METER
+    for (i = 0; i < RELAY_COUNT; i++)
+    {
+      MemoryGetBuffer((WORD)&EEOFFSET_APP_far.meterEnergy[i], (BYTE *)&meter[i].energy, sizeof(DWORD));
+      meter[i].energySaved = meter[i].energy;
+      meter[i].energyReported = meter[i].energy;
+    }
+#endif
+    ZW_DEBUG_APP_SEND_NL();
+    ZW_DEBUG_APP_SEND_BYTE('C');
+    ZW_DEBUG_APP_SEND_BYTE('l');
+
+    AssociationInit(FALSE);
+  }
+  else
+  {
+    ZW_MEM_PUT_BYTE((WORD)&EEOFFS_SECURITY_RESERVED.EEOFFS_MAGIC_BYTE_field, EEPROM_MAGIC_BYTE_VALUE);
+    /* Initialize transport layer NVM */
+    Transport_SetDefault();
+    /* Reset protocol */
+    ZW_SetDefault();
+
+    /* Apparently there is no valid configuration in EEPROM, so load */
+    /* default values and save them to EEPROM. */
+    SetDefaultConfiguration();
+
+    /*Clear association*/
+    AssociationInit(TRUE);
+
+    loadInitStatusPowerLevel(NULL, NULL);
+  }
+}
+
+
+/*
+ * @brief Called when protocol needs to inform Application about a Security Event.
+ * @details If the app does not need/want the Security Event the handling can be left empty.
+ *
+ *    Event E_APPLICATION_SECURITY_EVENT_S2_INCLUSION_REQUEST_DSK_CSA
+ *          If CSA is needed, the app must do the following when this event occures:
+ *             1. Obtain user input with first 4 bytes of the S2 including node DSK
+ *             2. Store the user input in a response variable of type s_SecurityS2InclusionCSAPublicDSK_t.
+ *             3. Call ZW_SetSecurityS2InclusionPublicDSK_CSA(response)
+ *
+ */
+void
+ApplicationSecurityEvent(
+  s_application_security_event_data_t *securityEvent)
+{
+	ZW_DEBUG_APP_SEND_STR("\nApplicationSecurityEvent()");
+  switch (securityEvent->event)
+  {
+#ifdef APP_SUPPORTS_CLIENT_SIDE_AUTHENTICATION
+    case E_APPLICATION_SECURITY_EVENT_S2_INCLUSION_REQUEST_DSK_CSA:
+      {
+				ZW_DEBUG_APP_SEND_STR("\nE_APPLICATION_SECURITY_EVENT_S2_INCLUSION_REQUEST_DSK_CSA");
+        ZW_SetSecurityS2InclusionPublicDSK_CSA(&sCSAResponse);
+      }
+      break;
+#endif /* APP_SUPPORTS_CLIENT_SIDE_AUTHENTICATION */
+
+    default:
+      break;
+  }
+}
+
+
+/**
+* Set up security keys to request when joining a network.
+* These are taken from the config_app.h header file.
+*/
+BYTE ApplicationSecureKeysRequested(void)
+{
+	ZW_DEBUG_APP_SEND_STR("\nApplicationSecureKeysRequested()");
+  return REQUESTED_SECURITY_KEYS;
+}
+
+/**
+* Set up security S2 inclusion authentication to request when joining a network.
+* These are taken from the config_app.h header file.
+*/
+BYTE ApplicationSecureAuthenticationRequested(void)
+{
+	ZW_DEBUG_APP_SEND_STR("\nApplicationSecureAuthenticationRequested()");
+  return REQUESTED_SECURITY_AUTHENTICATION;
+}
+
+
+
+/**
+ * @brief Sends Basic Set to the control group of a key.
+ * @details The transport sends one multicast to the group followed by
+ * singlecast follow-ups. If the request buffer is busy, the value is kept
+ * and sent when the current transmission completes. A newer value for the
+ * same key replaces the pending one.
+ * @param key Key index, 0 for S1.
+ * @param on Relay state the key has just set.
+ */
+void
+KeyGroupSend(BYTE key, BYTE on)
+{
+  BYTE mask = (BYTE)(1 << key);
+
+  if (key >= NUMBER_OF_KEY_GROUPS)
+  {
+    return;
+  }
+  if (on)
+  {
+    keyGroupValue |= mask;
+  }
+  else
+  {
+    keyGroupValue &= ~mask;
+  }
+  if (AssocGroupEmpty(ASSOC_GROUP_KEY_FIRST + key))
+  {
+    return;
+  }
+  keyGroupPending |= mask;
+  AppRequestSendNext();
+}
+
+
+/**
+ * @brief Starts transmission of the lowest pending key group.
+ * @return TRUE if the request buffer is now in use, FALSE if nothing was
+ * started.
+ */
+static BOOL
+KeyGroupSendNext(void)
+{
+  BYTE key;
+  BYTE mask;
+  JOB_STATUS status;
+
+  for (key = 0; key < NUMBER_OF_KEY_GROUPS; key++)
+  {
+    mask = (BYTE)(1 << key);
+    if (keyGroupPending & mask)
+    {
+      status = CmdClassBasicSetSend(&agiTableKeyGroups[key].profile,
+                                    ENDPOINT_ROOT,
+                                    (keyGroupValue & mask) ? CMD_CLASS_BIN_ON : CMD_CLASS_BIN_OFF,
+                                    ZCB_AppRequestDone);
+      if (JOB_STATUS_BUSY == status)
+      {
+        appRequestBusy = TRUE;
+        return TRUE;
+      }
+      ZW_DEBUG_APP_SEND_STR("\nKeyGroupSend ");
+      ZW_DEBUG_APP_SEND_NUM(key);
+      ZW_DEBUG_APP_SEND_NUM(status);
+      keyGroupPending &= ~mask;
+      if (JOB_STATUS_SUCCESS == status)
+      {
+        return TRUE;
+      }
+    }
+  }
+  return FALSE;
+}
+
+
+/**
+ * @brief Starts the next pending unsolicited transmission.
+ * @details All unsolicited frames share the request buffer. A sender that
+ * finds it busy keeps its frame pending. This function runs again when
+ * the application's own job completes, or after APP_REQUEST_RETRY_TICKS
+ * when another job holds the buffer.
+ */
+static void
+AppRequestSendNext(void)
+{
+  if (APP_TIMER_NONE != groupcastHoldTimer)
+  {
+    /* Sent by ZCB_GroupcastHoldDone() */
+    return;
+  }
+  if (appRequestActive || (APP_TIMER_NONE != appRequestRetryTimer))
+  {
+    /* Sent by ZCB_AppRequestDone() or ZCB_AppRequestRetry() */
+    return;
+  }
+  appRequestBusy = FALSE;
+  appRequestActive = (KeyGroupSendNext() ||
+#ifdef APP_FEATURE_CENTRAL_SCENE
+                      CentralSceneSendNext() ||
+#endif
+                      RelayReportSendNext() ||
+#ifdef APP_FEATURE_METER
+                      (!otaActive && MeterReportSendNext()) ||
+#endif
+#ifdef APP_FEATURE_LINK_STATS
+                      (!otaActive && LinkAlertSendNext()) ||
+#endif
+                      FALSE) ? TRUE : FALSE;
+  if (appRequestBusy)
+  {
+    appRequestActive = FALSE;
+    appRequestRetryTimer = ZW_TIMER_START(ZCB_AppRequestRetry, APP_REQUEST_RETRY_TICKS, TIMER_ONE_TIME);
+  }
+}
+
+
+/**
+ * @brief Timer callback retrying the pending unsolicited frames.
+ */
+PCB(ZCB_AppRequestRetry)(void)
+{
+  appRequestRetryTimer = APP_TIMER_NONE;
+  AppRequestSendNext();
+  AppRebootCheck();
+}
+
+
+/**
+ * @brief Tells whether unsolicited frames are in flight or still queued.
+ * @return TRUE if a frame is being sent, waits for the request buffer or
+ * is queued by one of the senders.
+ */
+static BOOL
+AppRequestPending(void)
+{
+  return (appRequestActive ||
+          (APP_TIMER_NONE != appRequestRetryTimer) ||
+          (APP_TIMER_NONE != groupcastHoldTimer) ||
+          keyGroupPending ||
+#ifdef APP_FEATURE_CENTRAL_SCENE
+          centralScene.queueCount ||
+#endif
+#ifdef APP_FEATURE_METER
+          meterReportPending ||
+#endif
+#ifdef APP_FEATURE_LINK_STATS
+          linkAlertPending ||
+#endif
+          relayReportPending) ? TRUE : FALSE;
+}
+
+
+/**
+ * @brief Transmission callback for unsolicited application requests.
+ * @param pTransmissionResult Result of each transmission.
+ */
+PCB(ZCB_AppRequestDone)(TRANSMISSION_RESULT * pTransmissionResult)
+{
+#ifdef APP_FEATURE_LINK_STATS
+  LinkStatsTx(pTransmissionResult->nodeId, pTransmissionResult->status);
+#endif
+  if (TRANSMISSION_RESULT_FINISHED == pTransmissionResult->isFinished)
+  {
+    appRequestActive = FALSE;
+    AppRequestSendNext();
+    AppRebootCheck();
+  }
+}
+
+
+#ifdef APP_FEATURE_CENTRAL_SCENE
+/**
+ * @brief Queues a Central Scene notification for the lifeline.
+ * @param key Key index, 0 for S1. Scene numbers start at 1.
+ * @param keyAttribute Key attribute of the notification.
+ */
+static void
+CentralSceneNotify(BYTE key, BYTE keyAttribute)
+{
+  CENTRAL_SCENE_EVENT *pEvent;
+
+  ZW_DEBUG_APP_SEND_STR("\nCentralSceneNotify ");
+  ZW_DEBUG_APP_SEND_NUM(key);
+  ZW_DEBUG_APP_SEND_NUM(keyAttribute);
+
+  if ((CENTRAL_SCENE_QUEUE_SIZE == centralScene.queueCount) ||
+      AssocGroupEmpty(ASSOC_GROUP_LIFELINE))
+  {
+    /*Queue full or nobody to notify, drop the notification*/
+    return;
+  }
+  pEvent = &centralScene.queue[(centralScene.queueHead + centralScene.queueCount) % CENTRAL_SCENE_QUEUE_SIZE];
+  pEvent->sceneNumber = key + 1;
+  pEvent->keyAttribute = keyAttribute;
+  centralScene.queueCount++;
+  AppRequestSendNext();
+}
+
+
+/**
+ * @brief Sends the oldest queued Central Scene notification to the lifeline.
+ * @return TRUE if the request buffer is now in use, FALSE if nothing was
+ * started.
+ */
+static BOOL
+CentralSceneSendNext(void)
+{
+  ZW_APPLICATION_TX_BUFFER *pTxBuf;
+  CENTRAL_SCENE_EVENT *pEvent;
+  BYTE *pFrame;
+
+  while (centralScene.queueCount)
+  {
+    pTxBuf = GetRequestBuffer(ZCB_AppRequestDone);
+    if (IS_NULL(pTxBuf))
+    {
+      appRequestBusy = TRUE;
+      return TRUE;
+    }
+    pEvent = &centralScene.queue[centralScene.queueHead];
+    pFrame = (BYTE *)pTxBuf;
+    pFrame[0] = COMMAND_CLASS_CENTRAL_SCENE;
+    pFrame[1] = CENTRAL_SCENE_NOTIFICATION_V3;
+    pFrame[2] = centralScene.sequenceNumber++;
+    pFrame[3] = pEvent->keyAttribute;
+    if (centralScene.slowRefresh)
+    {
+      pFrame[3] |= CENTRAL_SCENE_SLOW_REFRESH_BIT;
+    }
+    pFrame[4] = pEvent->sceneNumber;
+    centralScene.queueHead = (centralScene.queueHead + 1) % CENTRAL_SCENE_QUEUE_SIZE;
+    centralScene.queueCount--;
+
+    if (JOB_STATUS_SUCCESS == ZW_TransportMulticast_SendRequest(
+                                pFrame,
+                                5,
+                                FALSE,
+                                ReqNodeList(&lifelineProfile,
+                                            (CMD_CLASS_GRP *)&(pTxBuf->ZW_Common.cmdClass),
+                                            ENDPOINT_ROOT),
+                                ZCB_RequestJobStatus))
+    {
+      return TRUE;
+    }
+    /*No lifeline or transport failure, drop this notification*/
+    FreeRequestBuffer();
+  }
+  return FALSE;
+}
+
+
+/**
+ * @brief Feeds a key event to the Central Scene gesture detector.
+ * @details A release within CENTRAL_SCENE_TAP_WINDOW of the first one is
+ * reported as pressed twice, a single release as pressed once after the
+ * window. A held key is reported as held down, repeated every 55 s in slow
+ * refresh mode and every 200 ms otherwise, and as released on key up.
+ * Pressing another key reports the pending press of the previous key at
+ * once.
+ * @param key Key index, 0 for S1.
+ * @param keyEvent One of KEY_GESTURE_DOWN, _HELD and _UP.
+ */
+static void
+CentralSceneKeyEvent(BYTE key, BYTE keyEvent)
+{
+  switch (keyEvent)
+  {
+    case KEY_GESTURE_DOWN:
+      if (APP_TIMER_NONE != centralScene.windowTimer)
+      {
+        ZW_TIMER_CANCEL(centralScene.windowTimer);
+        centralScene.windowTimer = APP_TIMER_NONE;
+        if (key != centralScene.key)
+        {
+          CentralSceneNotify(centralScene.key, CENTRAL_SCENE_KEY_PRESSED_1_TIME);
+          centralScene.taps = 0;
+        }
+      }
+      centralScene.key = key;
+      break;
+
+    case KEY_GESTURE_HELD:
+      if (key != centralScene.key)
+      {
+        break;
+      }
+      centralScene.held = TRUE;
+      centralScene.taps = 0;
+      CentralSceneNotify(key, CENTRAL_SCENE_KEY_HELD_DOWN);
+      centralScene.refreshTimer = ZW_TIMER_START(ZCB_CentralSceneRefresh,
+                                                 centralScene.slowRefresh ?
+                                                 CENTRAL_SCENE_SLOW_REFRESH_TICKS :
+                                                 CENTRAL_SCENE_REFRESH_TICKS,
+                                                 TIMER_FOREVER);
+      break;
+
+    case KEY_GESTURE_UP:
+      if (key != centralScene.key)
+      {
+        break;
+      }
+      if (centralScene.held)
+      {
+        CentralSceneHoldStop();
+        CentralSceneNotify(key, CENTRAL_SCENE_KEY_RELEASED);
+      }
+      else if (++centralScene.taps >= 2)
+      {
+        centralScene.taps = 0;
+        CentralSceneNotify(key, CENTRAL_SCENE_KEY_PRESSED_2_TIMES);
+      }
+      else
+      {
+        centralScene.windowTimer = ZW_TIMER_START(ZCB_CentralSceneWindow,
+                                                  CENTRAL_SCENE_TAP_WINDOW,
+                                                  TIMER_ONE_TIME);
+      }
+      break;
+  }
+}
+
+
+/**
+ * @brief Stops held key reporting without a released notification. Used
+ * when the key is released or the hold turns into learn mode.
+ */
+static void
+CentralSceneHoldStop(void)
+{
+  if (APP_TIMER_NONE != centralScene.refreshTimer)
+  {
+    ZW_TIMER_CANCEL(centralScene.refreshTimer);
+    centralScene.refreshTimer = APP_TIMER_NONE;
+  }
+  centralScene.held = FALSE;
+}
+
+
+/**
+ * @brief Timer callback closing the double press window of a key.
+ */
+PCB(ZCB_CentralSceneWindow)(void)
+{
+  centralScene.windowTimer = APP_TIMER_NONE;
+  centralScene.taps = 0;
+  CentralSceneNotify(centralScene.key, CENTRAL_SCENE_KEY_PRESSED_1_TIME);
+}
+
+
+/**
+ * @brief Timer callback repeating the held down notification.
+ */
+PCB(ZCB_CentralSceneRefresh)(void)
+{
+  CentralSceneNotify(centralScene.key, CENTRAL_SCENE_KEY_HELD_DOWN);
+}
+
+
+/**
+ * @brief Handler for the Central Scene command class.
+ * @param rxOpt Receive options.
+ * @param pCmd Received frame.
+ * @param cmdLength Length of the received frame.
+ * @return Frame status for the transport layer.
+ */
+received_frame_status_t
+handleCommandClassCentralScene(
+  RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+  ZW_APPLICATION_TX_BUFFER *pCmd,
+  BYTE cmdLength)
+{
+  BYTE *pFrame = (BYTE *)pCmd;
+  ZW_APPLICATION_TX_BUFFER *pTxBuf;
+  BYTE *pReport;
+
+  switch (pCmd->ZW_Common.cmd)
+  {
+    case CENTRAL_SCENE_SUPPORTED_GET_V3:
+    case CENTRAL_SCENE_CONFIGURATION_GET_V3:
+      if (TRUE == Check_not_legal_response_job(rxOpt))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pTxBuf = GetResponseBuffer();
+      if (IS_NULL(pTxBuf))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pReport = (BYTE *)pTxBuf;
+      pReport[0] = COMMAND_CLASS_CENTRAL_SCENE;
+      if (CENTRAL_SCENE_CONFIGURATION_GET_V3 == pCmd->ZW_Common.cmd)
+      {
+        pReport[1] = CENTRAL_SCENE_CONFIGURATION_REPORT_V3;
+        pReport[2] = centralScene.slowRefresh ? CENTRAL_SCENE_SLOW_REFRESH_BIT : 0;
+        return SendAppResponse(rxOpt, pTxBuf, 3);
+      }
+      pReport[1] = CENTRAL_SCENE_SUPPORTED_REPORT_V3;
+      pReport[2] = NUMBER_OF_KEY_GROUPS;
+      /*Slow refresh supported, one bit mask byte, identical for all scenes*/
+      pReport[3] = CENTRAL_SCENE_SLOW_REFRESH_BIT | (1 << 1) | 0x01;
+      pReport[4] = (1 << CENTRAL_SCENE_KEY_PRESSED_1_TIME) |
+                   (1 << CENTRAL_SCENE_KEY_RELEASED) |
+                   (1 << CENTRAL_SCENE_KEY_HELD_DOWN) |
+                   (1 << CENTRAL_SCENE_KEY_PRESSED_2_TIMES);
+      return SendAppResponse(rxOpt, pTxBuf, 5);
+
+    case CENTRAL_SCENE_CONFIGURATION_SET_V3:
+      /* A setting is not changed by a broadcast or multicast */
+      if ((cmdLength < 3) || (TRUE == Check_not_legal_response_job(rxOpt)))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      centralScene.slowRefresh = (pFrame[2] & CENTRAL_SCENE_SLOW_REFRESH_BIT) ? TRUE : FALSE;
+      NvmMarkDirty(NVM_DIRTY_CENTRAL_SCENE);
+      return RECEIVED_FRAME_STATUS_SUCCESS;
+  }
+  return RECEIVED_FRAME_STATUS_NO_SUPPORT;
+}
+#endif /* APP_FEATURE_CENTRAL_SCENE */
+
+
+/**
+ * @brief Called by the relay setters after a relay has been set.
+ * @param relay Relay index, 0 for D1.
+ * @param on New relay state.
+ */
+static void
+RelayChanged(BYTE relay, BYTE on)
+{
+  BYTE mask = (BYTE)(1 << relay);
+
+  if (((relayLastState & mask) ? TRUE : FALSE) != (on ? TRUE : FALSE))
+  {
+    relayLastState ^= mask;
+    if (CONFIG_POWER_ON_RESTORE == configValues[CONFIG_POWER_ON_STATE])
+    {
+      NvmMarkDirty(NVM_DIRTY_RELAYS);
+    }
+    if ((((CONFIG_REPORTS_ALL == configValues[CONFIG_LIFELINE_REPORTS]) && !rxFromLifeline) ||
+         ((CONFIG_REPORTS_LOCAL == configValues[CONFIG_LIFELINE_REPORTS]) && !rxFrameInProgress)) &&
+        !AssocGroupEmpty(ASSOC_GROUP_LIFELINE))
+    {
+      relayReportPending |= mask;
+      AppRequestSendNext();
+    }
+  }
+#ifdef APP_FEATURE_SCENES
+  sceneActive = 0;
+#endif
+  /* A direct change overrides a pending duration and restarts auto-off */
+  TimerWheelCancel(&relayTimers.transition[relay]);
+  TimerWheelCancel(&relayTimers.autoOff[relay]);
+  if (on && relayTimers.autoOffSeconds[relay])
+  {
+    relayTimers.autoOff[relay] = TimerWheelInsert(relayTimers.autoOffSeconds[relay],
+                                                  TW_ACTION_AUTO_OFF | relay);
+  }
+}
+
+
+/**
+ * @brief Initializes the timer wheel and starts its one second tick.
+ */
+static void
+TimerWheelInit(void)
+{
+  BYTE i;
+
+  memset(timerWheel.slots, TIMER_WHEEL_NONE, sizeof(timerWheel.slots));
+  for (i = 0; i < TIMER_WHEEL_POOL; i++)
+  {
+    timerWheel.entries[i].next = i + 1;
+  }
+  timerWheel.entries[TIMER_WHEEL_POOL - 1].next = TIMER_WHEEL_NONE;
+  timerWheel.freeList = 0;
+  timerWheel.cursor = 0;
+  memset(relayTimers.autoOff, TIMER_WHEEL_NONE, sizeof(relayTimers.autoOff));
+  memset(relayTimers.transition, TIMER_WHEEL_NONE, sizeof(relayTimers.transition));
+  ZW_TIMER_START(ZCB_TimerWheelTick, TIMER_WHEEL_TICKS, TIMER_FOREVER);
+}
+
+
+/**
+ * @brief Inserts an action in the timer wheel. O(1).
+ * @param delay Seconds until the action runs, 0 counts as 1.
+ * @param action TW_ACTION_* flags and relay index.
+ * @return Handle of the entry, TIMER_WHEEL_NONE if the pool is exhausted.
+ */
+static BYTE
+TimerWheelInsert(WORD delay, BYTE action)
+{
+  BYTE handle = timerWheel.freeList;
+  TIMER_WHEEL_ENTRY *pEntry;
+
+  if (TIMER_WHEEL_NONE == handle)
+  {
+    ZW_DEBUG_APP_SEND_STR("\nTimerWheel full");
+    return TIMER_WHEEL_NONE;
+  }
+  if (0 == delay)
+  {
+    delay = 1;
+  }
+  pEntry = &timerWheel.entries[handle];
+  timerWheel.freeList = pEntry->next;
+  pEntry->slot = (BYTE)((timerWheel.cursor + delay) & (TIMER_WHEEL_SLOTS - 1));
+  pEntry->rounds = (delay - 1) >> TIMER_WHEEL_SLOTS_LOG2;
+  pEntry->action = action;
+  pEntry->prev = TIMER_WHEEL_NONE;
+  pEntry->next = timerWheel.slots[pEntry->slot];
+  if (TIMER_WHEEL_NONE != pEntry->next)
+  {
+    timerWheel.entries[pEntry->next].prev = handle;
+  }
+  timerWheel.slots[pEntry->slot] = handle;
+  return handle;
+}
+
+
+/**
+ * @brief Unlinks an entry from the list it is in.
+ * @param handle Entry to unlink.
+ */
+static void
+TimerWheelUnlink(BYTE handle)
+{
+  TIMER_WHEEL_ENTRY *pEntry = &timerWheel.entries[handle];
+
+  if (TIMER_WHEEL_NONE != pEntry->prev)
+  {
+    timerWheel.entries[pEntry->prev].next = pEntry->next;
+  }
+  else
+  {
+    timerWheel.slots[pEntry->slot] = pEntry->next;
+  }
+  if (TIMER_WHEEL_NONE != pEntry->next)
+  {
+    timerWheel.entries[pEntry->next].prev = pEntry->prev;
+  }
+}
+
+
+/**
+ * @brief Cancels an entry and returns it to the pool. O(1).
+ * @param pHandle Handle of the entry, set to TIMER_WHEEL_NONE. Nothing is
+ * done if it already is.
+ */
+static void
+TimerWheelCancel(BYTE *pHandle)
+{
+  if (TIMER_WHEEL_NONE != *pHandle)
+  {
+    TimerWheelUnlink(*pHandle);
+    timerWheel.entries[*pHandle].next = timerWheel.freeList;
+    timerWheel.freeList = *pHandle;
+    *pHandle = TIMER_WHEEL_NONE;
+  }
+}
+
+
+/**
+ * @brief Returns the seconds left until an entry runs.
+ * @param handle Entry handle.
+ * @return Remaining seconds.
+ */
+static WORD
+TimerWheelRemaining(BYTE handle)
+{
+  TIMER_WHEEL_ENTRY *pEntry = &timerWheel.entries[handle];
+  BYTE ahead = (BYTE)((pEntry->slot - timerWheel.cursor) & (TIMER_WHEEL_SLOTS - 1));
+
+  if (0 == ahead)
+  {
+    ahead = TIMER_WHEEL_SLOTS;
+  }
+  return (pEntry->rounds << TIMER_WHEEL_SLOTS_LOG2) + ahead;
+}
+
+
+/**
+ * @brief Timer wheel tick. Advances one slot and runs the entries of that
+ * slot which are on their last round.
+ * @details Due entries are first moved to the expiring list, then run one by
+ * one. An action may insert or cancel entries, including other due ones,
+ * without breaking the walk.
+ */
+PCB(ZCB_TimerWheelTick)(void)
+{
+  BYTE handle;
+  BYTE next;
+  BYTE action;
+  BYTE relay;
+
+#ifdef APP_FEATURE_CRASH_RING
+  crashRecord.uptime++;
+  if (crashRecordDirty && (0 == (crashRecord.uptime % CRASH_RING_FLUSH_INTERVAL)))
+  {
+    NvmMarkDirty(NVM_DIRTY_CRASH);
+  }
+#endif
+#ifdef APP_FEATURE_METER
+  MeterTick();
+#endif
+
+  timerWheel.cursor = (timerWheel.cursor + 1) & (TIMER_WHEEL_SLOTS - 1);
+  for (handle = timerWheel.slots[timerWheel.cursor]; TIMER_WHEEL_NONE != handle; handle = next)
+  {
+    next = timerWheel.entries[handle].next;
+    if (timerWheel.entries[handle].rounds)
+    {
+      timerWheel.entries[handle].rounds--;
+    }
+    else
+    {
+      TimerWheelUnlink(handle);
+      timerWheel.entries[handle].slot = TIMER_WHEEL_EXPIRING;
+      timerWheel.entries[handle].prev = TIMER_WHEEL_NONE;
+      timerWheel.entries[handle].next = timerWheel.slots[TIMER_WHEEL_EXPIRING];
+      if (TIMER_WHEEL_NONE != timerWheel.slots[TIMER_WHEEL_EXPIRING])
+      {
+        timerWheel.entries[timerWheel.slots[TIMER_WHEEL_EXPIRING]].prev = handle;
+      }
+      timerWheel.slots[TIMER_WHEEL_EXPIRING] = handle;
+    }
+  }
+
+  while (TIMER_WHEEL_NONE != timerWheel.slots[TIMER_WHEEL_EXPIRING])
+  {
+    handle = timerWheel.slots[TIMER_WHEEL_EXPIRING];
+    action = timerWheel.entries[handle].action;
+    relay = action & TW_ACTION_RELAY_MASK;
+    if (action & TW_ACTION_SMARTSTART)
+    {
+      smartStartHandle = TIMER_WHEEL_NONE;
+    }
+    else if (action & TW_ACTION_NVM_FLUSH)
+    {
+      nvmFlushHandle = TIMER_WHEEL_NONE;
+    }
+    else if (action & TW_ACTION_AUTO_OFF)
+    {
+      relayTimers.autoOff[relay] = TIMER_WHEEL_NONE;
+    }
+    else
+    {
+      relayTimers.transition[relay] = TIMER_WHEEL_NONE;
+    }
+    TimerWheelCancel(&handle);
+    if (action & TW_ACTION_SMARTSTART)
+    {
+      SmartStartBegin();
+    }
+    else if (action & TW_ACTION_NVM_FLUSH)
+    {
+      NvmFlush();
+    }
+    else
+    {
+      relays_state_set((BYTE)(1 << relay), (action & TW_ACTION_ON) ? RELAY_MASK_ALL : 0);
+    }
+  }
+}
+
+
+/**
+ * @brief Converts a Binary Switch v2 duration to seconds.
+ * @param duration 0 instant, 0x01-0x7F seconds, 0x80-0xFE minutes, 0xFF
+ * default (instant).
+ * @return Duration in seconds.
+ */
+static WORD
+DurationToSeconds(BYTE duration)
+{
+  if (duration <= 0x7F)
+  {
+    return duration;
+  }
+  if (0xFF == duration)
+  {
+    return 0;
+  }
+  return (WORD)(duration - 0x7F) * 60;
+}
+
+
+/**
+ * @brief Converts remaining seconds to a Basic and Binary Switch v2 duration,
+ * rounding minutes up.
+ * @param seconds Remaining seconds.
+ * @return Encoded duration.
+ */
+static BYTE
+SecondsToDuration(WORD seconds)
+{
+  WORD minutes;
+
+  if (seconds <= 0x7F)
+  {
+    return (BYTE)seconds;
+  }
+  minutes = (seconds + 59) / 60;
+  if (minutes > (0xFE - 0x7F))
+  {
+    return 0xFE;
+  }
+  return (BYTE)(0x7F + minutes);
+}
+
+
+#ifdef APP_FEATURE_SCENES
+/**
+ * @brief Handler for Scene Activation Set. A configured scene is applied to
+ * all its relays in one step through relays_state_set(), the path Switch
+ * All uses. Unconfigured scenes are ignored.
+ * @param rxOpt Receive options.
+ * @param pCmd Received frame.
+ * @param cmdLength Length of the received frame.
+ * @return Frame status for the transport layer.
+ */
+received_frame_status_t
+handleCommandClassSceneActivation(
+  RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+  ZW_APPLICATION_TX_BUFFER *pCmd,
+  BYTE cmdLength)
+{
+  BYTE sceneId;
+  BYTE record;
+
+  UNUSED(rxOpt);
+  if ((SCENE_ACTIVATION_SET != pCmd->ZW_Common.cmd) || (cmdLength < 3))
+  {
+    return RECEIVED_FRAME_STATUS_NO_SUPPORT;
+  }
+  sceneId = pCmd->ZW_SceneActivationSetFrame.sceneId;
+  if ((0 == sceneId) || (0 == (sceneIndex[sceneId >> 3] & (1 << (sceneId & 0x07)))))
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
+  record = MemoryGetByte((WORD)&EEOFFSET_APP_far.sceneTable[sceneId - 1]);
+  relays_state_set(SCENE_RECORD_MASK(record), SCENE_RECORD_VALUES(record));
+  sceneActive = sceneId;
+  return RECEIVED_FRAME_STATUS_SUCCESS;
+}
+
+
+/**
+ * @brief Returns the relays a Scene Actuator Configuration frame is about.
+ * @param endpoint Destination endpoint. The root device covers all relays,
+ * endpoint n the relay Binary Switch controls at endpoint n.
+ * @return Relay mask, 0 for an endpoint without a relay.
+ */
+static BYTE
+SceneEndpointMask(BYTE endpoint)
+{
+  if (ENDPOINT_ROOT == endpoint)
+  {
+    return RELAY_MASK_ALL;
+  }
+  return (endpoint < RELAY_COUNT) ? (BYTE)(1 << endpoint) : 0;
+}
+
+
+/**
+ * @brief Handler for Scene Actuator Configuration.
+ * @details A Set changes the relays of its destination endpoint only: all
+ * relays at the root device, one relay at an endpoint. The other relays
+ * keep what the scene already had for them. Set with override stores the
+ * level, where level 0 is off and any other level is on. Set without
+ * override stores the current relay states. Get of scene 0 reports the
+ * active scene. Dimming duration is not supported and always reported as
+ * 0.
+ * @param rxOpt Receive options.
+ * @param pCmd Received frame.
+ * @param cmdLength Length of the received frame.
+ * @return Frame status for the transport layer.
+ */
+received_frame_status_t
+handleCommandClassSceneActuatorConf(
+  RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+  ZW_APPLICATION_TX_BUFFER *pCmd,
+  BYTE cmdLength)
+{
+  ZW_APPLICATION_TX_BUFFER *pTxBuf;
+  BYTE sceneId;
+  BYTE record;
+  BYTE mask;
+  BYTE relays = SceneEndpointMask(rxOpt->destNode.endpoint);
+  BYTE values;
+
+  if (0 == relays)
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
+  switch (pCmd->ZW_Common.cmd)
+  {
+    case SCENE_ACTUATOR_CONF_SET:
+      if (cmdLength < sizeof(ZW_SCENE_ACTUATOR_CONF_SET_FRAME))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      sceneId = pCmd->ZW_SceneActuatorConfSetFrame.sceneId;
+      if (0 == sceneId)
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      if (pCmd->ZW_SceneActuatorConfSetFrame.level2 & SCENE_ACTUATOR_CONF_SET_LEVEL2_OVERRIDE_BIT_MASK)
+      {
+        values = pCmd->ZW_SceneActuatorConfSetFrame.level ? RELAY_MASK_ALL : 0;
+      }
+      else
+      {
+        values = relays_state_get();
+      }
+      if (sceneIndex[sceneId >> 3] & (1 << (sceneId & 0x07)))
+      {
+        record = MemoryGetByte((WORD)&EEOFFSET_APP_far.sceneTable[sceneId - 1]);
+      }
+      else
+      {
+        record = SCENE_RECORD(0, 0);
+      }
+      record = SCENE_RECORD(SCENE_RECORD_MASK(record) | relays,
+                            (SCENE_RECORD_VALUES(record) & ~relays) | (values & relays));
+      MemoryPutByte((WORD)&EEOFFSET_APP_far.sceneTable[sceneId - 1], record);
+      mask = (BYTE)(1 << (sceneId & 0x07));
+      if (0 == (sceneIndex[sceneId >> 3] & mask))
+      {
+        sceneIndex[sceneId >> 3] |= mask;
+        MemoryPutByte((WORD)&EEOFFSET_APP_far.sceneIndex[sceneId >> 3], sceneIndex[sceneId >> 3]);
+      }
+      return RECEIVED_FRAME_STATUS_SUCCESS;
+
+    case SCENE_ACTUATOR_CONF_GET:
+      if ((cmdLength < sizeof(ZW_SCENE_ACTUATOR_CONF_GET_FRAME)) ||
+          (TRUE == Check_not_legal_response_job(rxOpt)))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pTxBuf = GetResponseBuffer();
+      if (IS_NULL(pTxBuf))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      sceneId = pCmd->ZW_SceneActuatorConfGetFrame.sceneId;
+      if (0 == sceneId)
+      {
+        sceneId = sceneActive;
+      }
+      if ((0 != sceneId) && (sceneIndex[sceneId >> 3] & (1 << (sceneId & 0x07))))
+      {
+        record = MemoryGetByte((WORD)&EEOFFSET_APP_far.sceneTable[sceneId - 1]);
+      }
+      else
+      {
+        record = SCENE_RECORD(0, 0);
+      }
+      pTxBuf->ZW_SceneActuatorConfReportFrame.cmdClass = COMMAND_CLASS_SCENE_ACTUATOR_CONF;
+      pTxBuf->ZW_SceneActuatorConfReportFrame.cmd = SCENE_ACTUATOR_CONF_REPORT;
+      pTxBuf->ZW_SceneActuatorConfReportFrame.sceneId = sceneId;
+      pTxBuf->ZW_SceneActuatorConfReportFrame.level =
+        (SCENE_RECORD_VALUES(record) & relays) ? CMD_CLASS_BIN_ON : CMD_CLASS_BIN_OFF;
+      pTxBuf->ZW_SceneActuatorConfReportFrame.dimmingDuration = 0;
+      return SendAppResponse(rxOpt, pTxBuf, sizeof(ZW_SCENE_ACTUATOR_CONF_REPORT_FRAME));
+  }
+  return RECEIVED_FRAME_STATUS_NO_SUPPORT;
+}
+#endif /* APP_FEATURE_SCENES */
+
+
+/**
+ * @brief Tells whether an association group has no members.
+ * @details The association module keeps the node lists in RAM, so their
+ * length is read directly instead of keeping an index of its own.
+ * @param groupId Association group, 1 for the lifeline.
+ * @return TRUE if the group is empty or does not exist.
+ */
+static BOOL
+AssocGroupEmpty(BYTE groupId)
+{
+  MULTICHAN_NODE_ID *pList;
+  BYTE listLen;
+
+  if ((0 == groupId) || (groupId > MAX_ASSOCIATION_GROUPS))
+  {
+    return TRUE;
+  }
+  if (NODE_LIST_STATUS_SUCCESS != handleAssociationGetnodeList(groupId, ENDPOINT_ROOT, &pList, &listLen))
+  {
+    return TRUE;
+  }
+  return (0 == listLen) ? TRUE : FALSE;
+}
+
+
+/**
+ * @brief Tells whether a node is the one and only member of an
+ * association group, as a plain node or through any of its endpoints.
+ * @param groupId Association group, 1 for the lifeline.
+ * @param nodeId Node ID.
+ * @return TRUE if the group has exactly one member and it is nodeId.
+ */
+static BOOL
+AssocIsOnlyMember(BYTE groupId, APP_NODE_ID nodeId)
+{
+  MULTICHAN_NODE_ID *pList;
+  BYTE listLen;
+
+  if ((0 == groupId) || (groupId > MAX_ASSOCIATION_GROUPS) || (0 == nodeId))
+  {
+    return FALSE;
+  }
+  if (NODE_LIST_STATUS_SUCCESS != handleAssociationGetnodeList(groupId, ENDPOINT_ROOT, &pList, &listLen))
+  {
+    return FALSE;
+  }
+  return ((1 == listLen) && (nodeId == pList->nodeId)) ? TRUE : FALSE;
+}
+
+
+/**
+ * @brief Prepares the dispatch of a broadcast or multicast frame.
+ * @details Unsolicited frames queued by the handler are held for a node
+ * specific delay and then sent as one batch, a relay changed several times
+ * giving one report of its final state. The sender of a broadcast or
+ * multicast gets no acknowledgement, so the lifeline report is always
+ * made. The Get handlers already answer no broadcast or multicast through
+ * Check_not_legal_response_job().
+ * @param rxOpt Receive options of the frame.
+ */
+static void
+GroupcastReceived(RECEIVE_OPTIONS_TYPE_EX *rxOpt)
+{
+  ZW_DEBUG_APP_SEND_STR("\nGroupcastReceived ");
+  ZW_DEBUG_APP_SEND_NUM(rxOpt->rxStatus);
+  UNUSED(rxOpt);
+
+  if (APP_TIMER_NONE == groupcastHoldTimer)
+  {
+    groupcastHoldTimer = ZW_TIMER_START(ZCB_GroupcastHoldDone,
+                                        GROUPCAST_JITTER_BASE +
+                                        (BYTE)(((WORD)myNodeID * GROUPCAST_JITTER_STEP) % GROUPCAST_JITTER_SPAN),
+                                        TIMER_ONE_TIME);
+  }
+}
+
+
+/**
+ * @brief Sends the unsolicited frames held after a broadcast or multicast.
+ */
+PCB(ZCB_GroupcastHoldDone)(void)
+{
+  groupcastHoldTimer = APP_TIMER_NONE;
+  AppRequestSendNext();
+}
+
+
+/**
+ * @brief Handles a short key press. Toggles the relay of the key unless the
+ * key is detached, then controls the key's group and feeds the gesture
+ * detector.
+ * @param key Key index, 0 for S1.
+ */
+static void
+KeyPressed(BYTE key)
+{
+  BYTE mask = (BYTE)(1 << key);
+  BYTE on;
+
+  if (CONFIG_KEY_MODE_DETACHED == configValues[CONFIG_KEY_MODE])
+  {
+    /* Toggle the value last sent to the group */
+    on = (keyGroupValue & mask) ? FALSE : TRUE;
+  }
+  else
+  {
+    on = (relays_state_get() & mask) ? FALSE : TRUE;
+    relays_state_set(mask, on ? RELAY_MASK_ALL : 0);
+  }
+  KeyGroupSend(key, on);
+#ifdef APP_FEATURE_CENTRAL_SCENE
+  CentralSceneKeyEvent(key, KEY_GESTURE_UP);
+#endif
+}
+
+
+/**
+ * @brief Sends a lifeline Binary Switch Report for the lowest relay with a
+ * pending report. The relay index is the source endpoint, as in
+ * handleAppltBinarySwitchGet().
+ * @return TRUE if the request buffer is now in use, FALSE if nothing was
+ * started.
+ */
+static BOOL
+RelayReportSendNext(void)
+{
+  BYTE relay;
+  BYTE mask;
+  JOB_STATUS status;
+
+  for (relay = 0; relay < RELAY_COUNT; relay++)
+  {
+    mask = (BYTE)(1 << relay);
+    if (relayReportPending & mask)
+    {
+      status = CmdClassBinarySwitchReportSendUnsolicited(&lifelineProfile,
+                                                         relay,
+                                                         (relayLastState & mask) ? CMD_CLASS_BIN_ON : CMD_CLASS_BIN_OFF,
+                                                         ZCB_AppRequestDone);
+      if (JOB_STATUS_BUSY == status)
+      {
+        appRequestBusy = TRUE;
+        return TRUE;
+      }
+      relayReportPending &= ~mask;
+      if (JOB_STATUS_SUCCESS == status)
+      {
+        return TRUE;
+      }
+    }
+  }
+  return FALSE;
+}
+
+
+/**
+ * @brief Folds the DSK, the first 16 bytes of the S2 public key, into
+ * smartStartSeed.
+ */
+static void
+SmartStartSeedInit(void)
+{
+  BYTE publicKey[32];
+  BYTE i;
+
+  keystore_public_key_read(publicKey);
+  smartStartSeed = 0;
+  for (i = 0; i < 16; i++)
+  {
+    smartStartSeed = (smartStartSeed * 31) + publicKey[i];
+  }
+}
+
+
+/**
+ * @brief Schedules SmartStart inclusion after a random delay if the node
+ * is not included. The delay window doubles on every call.
+ */
+static void
+SmartStartSchedule(void)
+{
+  if (0 != myNodeID)
+  {
+    return;
+  }
+  TimerWheelCancel(&smartStartHandle);
+  smartStartHandle = TimerWheelInsert(1 + ((WORD)(smartStartSeed + ZW_Random()) % smartStartWindow),
+                                      TW_ACTION_SMARTSTART);
+  ZW_DEBUG_APP_SEND_STR("\nSmartStartSchedule ");
+  ZW_DEBUG_APP_SEND_NUM(smartStartWindow);
+  if (smartStartWindow < SMARTSTART_WINDOW_MAX)
+  {
+    smartStartWindow <<= 1;
+  }
+}
+
+
+/**
+ * @brief Starts SmartStart inclusion. Waits for another delay while a
+ * manual learn mode or other activity is in progress.
+ */
+static void
+SmartStartBegin(void)
+{
+  if (0 != myNodeID)
+  {
+    return;
+  }
+  if (STATE_APP_IDLE != currentState)
+  {
+    SmartStartSchedule();
+    return;
+  }
+  ZW_DEBUG_APP_SEND_STR("\nSmartStartBegin");
+  ZW_NetworkLearnModeStart(E_NETWORK_LEARN_MODE_INCLUSION_SMARTSTART);
+}
+
+
+/**
+ * @brief Marks RAM state as differing from NVM and arms the delayed flush.
+ * Changes within NVM_FLUSH_DELAY seconds share one write.
+ * @param flags NVM_DIRTY_* flags.
+ */
+static void
+NvmMarkDirty(BYTE flags)
+{
+  nvmDirty |= flags;
+  if (TIMER_WHEEL_NONE == nvmFlushHandle)
+  {
+    nvmFlushHandle = TimerWheelInsert(NVM_FLUSH_DELAY, TW_ACTION_NVM_FLUSH);
+    if (TIMER_WHEEL_NONE == nvmFlushHandle)
+    {
+      /* No wheel entry left, write at once */
+      NvmFlush();
+    }
+  }
+}
+
+
+/**
+ * @brief Writes RAM state marked dirty to NVM.
+ */
+static void
+NvmFlush(void)
+{
+#ifdef APP_FEATURE_METER
+  BYTE i;
+#endif
+
+  ZW_DEBUG_APP_SEND_STR("\nNvmFlush ");
+  ZW_DEBUG_APP_SEND_NUM(nvmDirty);
+
+  TimerWheelCancel(&nvmFlushHandle);
+  if (nvmDirty & NVM_DIRTY_CONFIG)
+  {
+    MemoryPutBuffer((WORD)&EEOFFSET_APP_far.configParams[0], (BYTE *)configValues, sizeof(configValues), NULL);
+  }
+  if (nvmDirty & NVM_DIRTY_RELAYS)
+  {
+    MemoryPutByte((WORD)&OnOffState_far, relayLastState);
+  }
+#ifdef APP_FEATURE_METER
+  if (nvmDirty & NVM_DIRTY_METER)
+  {
+    for (i = 0; i < RELAY_COUNT; i++)
+    {
+      meter[i].energySaved = meter[i].energy;
+      MemoryPutBuffer((WORD)&EEOFFSET_APP_far.meterEnergy[i], (BYTE *)&meter[i].energySaved,
+                      sizeof(DWORD), NULL);
+    }
+  }
+#endif
+#ifdef APP_FEATURE_CENTRAL_SCENE
+  if (nvmDirty & NVM_DIRTY_CENTRAL_SCENE)
+  {
+    MemoryPutByte((WORD)&EEOFFSET_APP_far.centralSceneSlowRefresh, centralScene.slowRefresh);
+  }
+#endif
+#ifdef APP_FEATURE_CRASH_RING
+  if (nvmDirty & NVM_DIRTY_CRASH)
+  {
+    CrashRingFlush(CRASH_CAUSE_NONE, NULL);
+  }
+#endif
+  nvmDirty = 0;
+}
+
+
+/**
+ * @brief Replaces parameters outside their range by the default and applies
+ * the parameters to the modules using them.
+ */
+static void
+ConfigApply(void)
+{
+  BYTE i;
+
+  for (i = 0; i < CONFIG_PARAM_COUNT; i++)
+  {
+    if ((configValues[i] < configParamInfo[i].minValue) ||
+        (configValues[i] > configParamInfo[i].maxValue))
+    {
+      configValues[i] = configParamInfo[i].defaultValue;
+    }
+  }
+  for (i = 0; i < RELAY_COUNT; i++)
+  {
+    relayTimers.autoOffSeconds[i] = configValues[CONFIG_AUTO_OFF_RELAY1 + i];
+  }
+}
+
+
+/**
+ * @brief Sets the relays as given by the power-on state parameter.
+ */
+static void
+ConfigPowerOnApply(void)
 {
-	if(sta) { relay1_on();  switch_state.s1 = 1; }
-	else    { relay1_off(); switch_state.s1 = 0; }
+  switch (configValues[CONFIG_POWER_ON_STATE])
+  {
+    case CONFIG_POWER_ON_RESTORE:
+      relays_state_set(RELAY_MASK_ALL, MemoryGetByte((WORD)&OnOffState_far));
+      break;
+
+    case CONFIG_POWER_ON_ON:
+      relays_state_set(RELAY_MASK_ALL, RELAY_MASK_ALL);
+      break;
+  }
 }
 
-static void s2_state_set(BYTE sta)
+
+#ifdef APP_FEATURE_CONFIGURATION
+/**
+ * @brief Sets a parameter in the RAM cache. NVM is written later.
+ * @param number Parameter number.
+ * @param value New value.
+ * @param useDefault TRUE to set the default value instead.
+ * @return FALSE if the parameter does not exist or the value is out of range.
+ */
+static BOOL
+ConfigParamSet(WORD number, WORD value, BOOL useDefault)
 {
-	if(sta) { relay2_on();  switch_state.s2 = 1; }
-	else    { relay2_off(); switch_state.s2 = 0; }
+  CONFIG_PARAM_INFO code *pInfo;
+
+  if ((0 == number) || (number > CONFIG_PARAM_COUNT))
+  {
+    return FALSE;
+  }
+  pInfo = &configParamInfo[number - 1];
+  if (useDefault)
+  {
+    value = pInfo->defaultValue;
+  }
+  if ((value < pInfo->minValue) || (value > pInfo->maxValue))
+  {
+    return FALSE;
+  }
+  if (configValues[number - 1] != value)
+  {
+    configValues[number - 1] = value;
+    ConfigApply();
+    NvmMarkDirty(NVM_DIRTY_CONFIG);
+  }
+  return TRUE;
 }
 
-static void s3_state_set(BYTE sta)
+
+/**
+ * @brief Writes parameter values in a Configuration Report or Bulk Report.
+ * @param pData Destination in the report.
+ * @param first First parameter number.
+ * @param count Number of parameters.
+ * @return Number of bytes written.
+ */
+static BYTE
+ConfigValuesPut(BYTE *pData, WORD first, BYTE count)
 {
-	if(sta) { relay3_on();  switch_state.s3 = 1; }
-	else    { relay3_off(); switch_state.s3 = 0; }
+  BYTE i;
+
+  for (i = 0; i < count; i++)
+  {
+    *pData++ = (BYTE)(configValues[first - 1 + i] >> 8);
+    *pData++ = (BYTE)configValues[first - 1 + i];
+  }
+  return (BYTE)(count * CONFIG_PARAM_SIZE);
 }
 
-#define s1_state_get() (BYTE)switch_state.s1
-#define s2_state_get() (BYTE)switch_state.s2
-#define s3_state_get() (BYTE)switch_state.s3
 
-void cb_timer_5s(void);
-PCB(cb_timer_5s)(void)
+/**
+ * @brief Sends a Bulk Report for a range of parameters, clipped to the
+ * parameters that exist and to CONFIG_BULK_MAX.
+ * @param rxOpt Receive options of the request.
+ * @param first First parameter number.
+ * @param count Number of parameters requested.
+ * @param properties CONFIG_PROPERTIES_HANDSHAKE when answering a Bulk Set.
+ * @return Frame status for the transport layer.
+ */
+static received_frame_status_t
+ConfigBulkReport(RECEIVE_OPTIONS_TYPE_EX *rxOpt, WORD first, BYTE count, BYTE properties)
 {
-	ZW_DEBUG_APP_SEND_STR("\ncb_timer_5s()");
-	
-	switch_state.learn = 1;
-	if(myNodeID) {
-		ZW_DEBUG_APP_SEND_STR("LEARN_MODE_EXCLUSION");
-		StartLearnModeNow(LEARN_MODE_EXCLUSION_NWE);
-	}
-	else{
-		ZW_DEBUG_APP_SEND_STR("LEARN_MODE_INCLUSION");
-		StartLearnModeNow(LEARN_MODE_INCLUSION);
-	}
-	ChangeState(STATE_APP_LEARN_MODE);
-	led_nwk_on();
+  ZW_APPLICATION_TX_BUFFER *pTxBuf;
+  BYTE *pReport;
+  BYTE i;
+
+  if ((0 == first) || (first > CONFIG_PARAM_COUNT))
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
+  if (count > (CONFIG_PARAM_COUNT + 1 - first))
+  {
+    count = (BYTE)(CONFIG_PARAM_COUNT + 1 - first);
+  }
+  if (count > CONFIG_BULK_MAX)
+  {
+    count = CONFIG_BULK_MAX;
+  }
+  pTxBuf = GetResponseBuffer();
+  if (IS_NULL(pTxBuf))
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
+  pReport = (BYTE *)pTxBuf;
+  pReport[0] = COMMAND_CLASS_CONFIGURATION;
+  pReport[1] = CONFIGURATION_BULK_REPORT_V4;
+  pReport[2] = (BYTE)(first >> 8);
+  pReport[3] = (BYTE)first;
+  pReport[4] = count;
+  pReport[5] = 0;
+  pReport[6] = properties | CONFIG_PARAM_SIZE;
+  for (i = 0; i < count; i++)
+  {
+    if (configValues[first - 1 + i] != configParamInfo[first - 1 + i].defaultValue)
+    {
+      break;
+    }
+  }
+  if (i == count)
+  {
+    pReport[6] |= CONFIG_PROPERTIES_DEFAULT;
+  }
+  return SendAppResponse(rxOpt, pTxBuf, 7 + ConfigValuesPut(&pReport[7], first, count));
 }
 
 
 /**
- * @brief See description for function prototype in ZW_basis_api.h.
+ * @brief Sends the next Name Report or Info Report of configText, up to
+ * CONFIG_TEXT_CHUNK characters. The reports to follow field tells how many
+ * more reports the rest of the string needs.
+ * @return Frame status for the transport layer.
  */
-BYTE
-ApplicationInitHW(SW_WAKEUP bWakeupReason)
+static received_frame_status_t
+ConfigTextSendNext(void)
 {
-  wakeupReason = bWakeupReason;
-  /* hardware initialization */
-  ZDP03A_InitHW(ZCB_EventSchedulerEventAdd, NULL);
-	
-  /*SetPinIn(ZDP03A_KEY_1,TRUE);
-  SetPinIn(ZDP03A_KEY_2,TRUE);
+  ZW_APPLICATION_TX_BUFFER *pTxBuf = GetResponseBufferCb(ZCB_ConfigTextSent);
+  received_frame_status_t status;
+  char code *pText = configText.pText;
+  BYTE *pReport;
+  BYTE len = 5;
+  BYTE rest = 0;
+
+  if (IS_NULL(pTxBuf))
+  {
+    configText.pText = NULL;
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
+  pReport = (BYTE *)pTxBuf;
+  pReport[0] = COMMAND_CLASS_CONFIGURATION;
+  pReport[1] = configText.cmd;
+  pReport[2] = (BYTE)(configText.number >> 8);
+  pReport[3] = (BYTE)configText.number;
+  while ((NULL != pText) && *pText && (len < (5 + CONFIG_TEXT_CHUNK)))
+  {
+    pReport[len++] = *pText++;
+  }
+  configText.pText = NULL;
+  while ((NULL != pText) && pText[rest])
+  {
+    rest++;
+  }
+  pReport[4] = (BYTE)((rest + CONFIG_TEXT_CHUNK - 1) / CONFIG_TEXT_CHUNK);
+  if (rest)
+  {
+    configText.pText = pText;
+  }
+  status = SendAppResponse(&configText.rxOpt, pTxBuf, len);
+  if (RECEIVED_FRAME_STATUS_SUCCESS != status)
+  {
+    configText.pText = NULL;
+  }
+  return status;
+}
 
-	// Learn mode indication
-  SetPinOut(ZDP03A_LED_D1); 
-  Led(ZDP03A_LED_D1,ON);
-  SetPinOut(ZDP03A_LED_D2);
-  Led(ZDP03A_LED_D2,ON);*/
-	
-	switch_init();
-	
-  Transport_OnApplicationInitHW(bWakeupReason);
 
-  return(TRUE);
+/**
+ * @brief Response callback of a Name Report or Info Report. The next
+ * report is sent from a timer, once the response buffer is released.
+ * @param pTransmissionResult Result of the transmission.
+ */
+PCB(ZCB_ConfigTextSent)(TRANSMISSION_RESULT * pTransmissionResult)
+{
+  if ((TRANSMISSION_RESULT_FINISHED == pTransmissionResult->isFinished) &&
+      (NULL != configText.pText))
+  {
+    if (APP_TIMER_NONE == ZW_TIMER_START(ZCB_ConfigTextNext, 1, TIMER_ONE_TIME))
+    {
+      configText.pText = NULL;
+    }
+  }
 }
 
 
 /**
- * @brief See description for function prototype in ZW_basis_api.h.
+ * @brief Sends the next part of the current Name Report or Info Report.
  */
-BYTE
-ApplicationInitSW(ZW_NVM_STATUS nvmStatus)
+PCB(ZCB_ConfigTextNext)(void)
 {
-  /* Init state machine */
-  currentState = STATE_APP_STARTUP;
-  /* Do not reinitialize the UART if already initialized for ISD51 in ApplicationInitHW() 
-	*/
-#ifndef ZW_ISD51_DEBUG
-  ZW_DEBUG_INIT(1152);
-#endif
+  ConfigTextSendNext();
+}
 
-  ZW_DEBUG_APP_SEND_STR("\nApplicationInitSW()");
-  ZW_DEBUG_APP_SEND_NUM(wakeupReason);
-  ZW_DEBUG_APP_SEND_NUM(nvmStatus);
-  ZW_DEBUG_APP_SEND_NL();
 
-#ifdef WATCHDOG_ENABLED
-  ZW_WatchDogEnable();
-#endif 
+/**
+ * @brief Sends Name Reports or Info Reports holding a string from the
+ * parameter table. A string longer than CONFIG_TEXT_CHUNK is split over
+ * several reports.
+ * @param rxOpt Receive options of the request.
+ * @param cmd CONFIGURATION_NAME_REPORT_V4 or CONFIGURATION_INFO_REPORT_V4.
+ * @param number Parameter number.
+ * @param pText String to report, NULL for an unknown parameter.
+ * @return Frame status for the transport layer.
+ */
+static received_frame_status_t
+ConfigTextReport(RECEIVE_OPTIONS_TYPE_EX *rxOpt, BYTE cmd, WORD number, char code *pText)
+{
+  if (NULL != configText.pText)
+  {
+    /* The previous string is still being sent */
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
+  configText.rxOpt = *rxOpt;
+  configText.cmd = cmd;
+  configText.number = number;
+  configText.pText = pText;
+  return ConfigTextSendNext();
+}
 
-  /* Signal that the sensor is awake */
-  LoadConfiguration(nvmStatus);
 
-  /* Setup AGI group lists */
-  AGI_Init();
-  AGI_LifeLineGroupSetup(agiTableLifeLine, (sizeof(agiTableLifeLine)/sizeof(CMD_CLASS_GRP)), GroupName, ENDPOINT_ROOT);
+/**
+ * @brief Handler for the Configuration command class, version 4.
+ * @details Set and Bulk Set update the RAM cache, which is written to NVM
+ * NVM_FLUSH_DELAY seconds later. Bulk Get reports up to CONFIG_BULK_MAX
+ * parameters in one frame. Properties, Name and Info Get report the
+ * compile time parameter table.
+ * @param rxOpt Receive options.
+ * @param pCmd Received frame.
+ * @param cmdLength Length of the received frame.
+ * @return Frame status for the transport layer.
+ */
+received_frame_status_t
+handleCommandClassConfiguration(
+  RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+  ZW_APPLICATION_TX_BUFFER *pCmd,
+  BYTE cmdLength)
+{
+  BYTE *pFrame = (BYTE *)pCmd;
+  ZW_APPLICATION_TX_BUFFER *pTxBuf;
+  BYTE *pReport;
+  CONFIG_PARAM_INFO code *pInfo;
+  WORD number;
+  BYTE count;
+  BYTE i;
+  BOOL ok;
+
+  if (cmdLength < 2)
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
 
-#ifdef BOOTLOADER_ENABLED
-  /* Initialize OTA module */
-    OtaInit( ZCB_OTAStart, NULL, ZCB_OTAFinish);
-#endif
+  switch (pFrame[1])
+  {
+    case CONFIGURATION_SET_V4:
+      if ((cmdLength < 4) ||
+          (!(pFrame[3] & CONFIG_PROPERTIES_DEFAULT) &&
+           (((pFrame[3] & CONFIG_PROPERTIES_SIZE_MASK) != CONFIG_PARAM_SIZE) ||
+            (cmdLength < (4 + CONFIG_PARAM_SIZE)))))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      ok = ConfigParamSet(pFrame[2],
+                          ((WORD)pFrame[4] << 8) | pFrame[5],
+                          (pFrame[3] & CONFIG_PROPERTIES_DEFAULT) ? TRUE : FALSE);
+      return ok ? RECEIVED_FRAME_STATUS_SUCCESS : RECEIVED_FRAME_STATUS_FAIL;
 
-  /* Initialize Event Scheduler */
-  EventSchedulerInit(AppStateManager);
+    case CONFIGURATION_BULK_SET_V4:
+      if (cmdLength < 6)
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      number = ((WORD)pFrame[2] << 8) | pFrame[3];
+      count = pFrame[4];
+      if (!(pFrame[5] & CONFIG_PROPERTIES_DEFAULT) &&
+          (((pFrame[5] & CONFIG_PROPERTIES_SIZE_MASK) != CONFIG_PARAM_SIZE) ||
+           (cmdLength < (6 + (count * CONFIG_PARAM_SIZE)))))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      ok = TRUE;
+      for (i = 0; i < count; i++)
+      {
+        if (!ConfigParamSet(number + i,
+                            ((WORD)pFrame[6 + (i * CONFIG_PARAM_SIZE)] << 8) |
+                            pFrame[7 + (i * CONFIG_PARAM_SIZE)],
+                            (pFrame[5] & CONFIG_PROPERTIES_DEFAULT) ? TRUE : FALSE))
+        {
+          ok = FALSE;
+        }
+      }
+      if ((pFrame[5] & CONFIG_PROPERTIES_HANDSHAKE) && (FALSE == Check_not_legal_response_job(rxOpt)))
+      {
+        return ConfigBulkReport(rxOpt, number, count, CONFIG_PROPERTIES_HANDSHAKE);
+      }
+      return ok ? RECEIVED_FRAME_STATUS_SUCCESS : RECEIVED_FRAME_STATUS_FAIL;
 
-  Transport_OnApplicationInitSW( &m_AppNIF, NULL);
+    case CONFIGURATION_DEFAULT_RESET_V4:
+      for (i = 0; i < CONFIG_PARAM_COUNT; i++)
+      {
+        configValues[i] = configParamInfo[i].defaultValue;
+      }
+      ConfigApply();
+      NvmMarkDirty(NVM_DIRTY_CONFIG);
+      return RECEIVED_FRAME_STATUS_SUCCESS;
+  }
 
-  /* Init state machine */
-  ZCB_EventSchedulerEventAdd((EVENT_WAKEUP)wakeupReason);
+  /* The remaining commands are requests for a report */
+  if (TRUE == Check_not_legal_response_job(rxOpt))
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
 
-  return(TRUE);
+  switch (pFrame[1])
+  {
+    case CONFIGURATION_GET_V4:
+      if ((cmdLength < 3) || (0 == pFrame[2]) || (pFrame[2] > CONFIG_PARAM_COUNT))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pTxBuf = GetResponseBuffer();
+      if (IS_NULL(pTxBuf))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pReport = (BYTE *)pTxBuf;
+      pReport[0] = COMMAND_CLASS_CONFIGURATION;
+      pReport[1] = CONFIGURATION_REPORT_V4;
+      pReport[2] = pFrame[2];
+      pReport[3] = CONFIG_PARAM_SIZE;
+      return SendAppResponse(rxOpt, pTxBuf, 4 + ConfigValuesPut(&pReport[4], pFrame[2], 1));
+
+    case CONFIGURATION_BULK_GET_V4:
+      if (cmdLength < 5)
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      return ConfigBulkReport(rxOpt, ((WORD)pFrame[2] << 8) | pFrame[3], pFrame[4], 0);
+
+    case CONFIGURATION_NAME_GET_V4:
+    case CONFIGURATION_INFO_GET_V4:
+      if (cmdLength < 4)
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      number = ((WORD)pFrame[2] << 8) | pFrame[3];
+      pInfo = ((0 != number) && (number <= CONFIG_PARAM_COUNT)) ? &configParamInfo[number - 1] : NULL;
+      if (CONFIGURATION_NAME_GET_V4 == pFrame[1])
+      {
+        return ConfigTextReport(rxOpt, CONFIGURATION_NAME_REPORT_V4, number,
+                                (NULL != pInfo) ? pInfo->pName : NULL);
+      }
+      return ConfigTextReport(rxOpt, CONFIGURATION_INFO_REPORT_V4, number,
+                              (NULL != pInfo) ? pInfo->pInfo : NULL);
+
+    case CONFIGURATION_PROPERTIES_GET_V4:
+      if (cmdLength < 4)
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pTxBuf = GetResponseBuffer();
+      if (IS_NULL(pTxBuf))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      number = ((WORD)pFrame[2] << 8) | pFrame[3];
+      pReport = (BYTE *)pTxBuf;
+      pReport[0] = COMMAND_CLASS_CONFIGURATION;
+      pReport[1] = CONFIGURATION_PROPERTIES_REPORT_V4;
+      pReport[2] = pFrame[2];
+      pReport[3] = pFrame[3];
+      if ((0 == number) || (number > CONFIG_PARAM_COUNT))
+      {
+        /* Unknown parameter: size 0 and the first parameter as next */
+        pReport[4] = 0;
+        pReport[5] = 0;
+        pReport[6] = (0 == number) ? 1 : 0;
+        pReport[7] = 0;
+        return SendAppResponse(rxOpt, pTxBuf, 8);
+      }
+      pInfo = &configParamInfo[number - 1];
+      pReport[4] = (CONFIG_FORMAT_UNSIGNED << 3) | CONFIG_PARAM_SIZE;
+      pReport[5] = (BYTE)(pInfo->minValue >> 8);
+      pReport[6] = (BYTE)pInfo->minValue;
+      pReport[7] = (BYTE)(pInfo->maxValue >> 8);
+      pReport[8] = (BYTE)pInfo->maxValue;
+      pReport[9] = (BYTE)(pInfo->defaultValue >> 8);
+      pReport[10] = (BYTE)pInfo->defaultValue;
+      number = (number < CONFIG_PARAM_COUNT) ? (number + 1) : 0;
+      pReport[11] = (BYTE)(number >> 8);
+      pReport[12] = (BYTE)number;
+      pReport[13] = 0;
+      return SendAppResponse(rxOpt, pTxBuf, 14);
+  }
+  return RECEIVED_FRAME_STATUS_NO_SUPPORT;
 }
+#endif /* APP_FEATURE_CONFIGURATION */
 
 
+#ifdef APP_FEATURE_METER
 /**
- * @brief See description for function prototype in ZW_basis_api.h.
+ * @brief Samples the power of each relay and accumulates energy. Called
+ * every second. Marks reports pending when a threshold is crossed.
  */
-void
-ApplicationTestPoll(void)
+static void
+MeterTick(void)
 {
+  METER_RELAY *pMeter = meter;
+  WORD delta;
+  BYTE relay;
+
+  for (relay = 0; relay < RELAY_COUNT; relay++, pMeter++)
+  {
+    pMeter->power = METER_SAMPLE_POWER(relay);
+    pMeter->residue += pMeter->power;
+    if (pMeter->residue >= METER_DWS_PER_UNIT)
+    {
+      pMeter->residue -= METER_DWS_PER_UNIT;
+      pMeter->energy++;
+      if ((pMeter->energy - pMeter->energySaved) >= METER_NVM_STEP)
+      {
+        NvmMarkDirty(NVM_DIRTY_METER);
+      }
+    }
+    if (pMeter->sinceReport < 0xFFFF)
+    {
+      pMeter->sinceReport++;
+    }
+    if (pMeter->holdoff)
+    {
+      pMeter->holdoff--;
+      continue;
+    }
+
+    delta = (pMeter->power > pMeter->powerReported) ?
+            (pMeter->power - pMeter->powerReported) : (pMeter->powerReported - pMeter->power);
+    if (configValues[CONFIG_METER_POWER_DELTA] &&
+        ((delta / 10) >= configValues[CONFIG_METER_POWER_DELTA]))
+    {
+      meterReportPending |= (BYTE)(1 << (relay + METER_PENDING_POWER_SHIFT));
+    }
+    if (pMeter->energy != pMeter->energyReported)
+    {
+      if ((configValues[CONFIG_METER_ENERGY_DELTA] &&
+           ((pMeter->energy - pMeter->energyReported) >= configValues[CONFIG_METER_ENERGY_DELTA])) ||
+          (configValues[CONFIG_METER_REPORT_INTERVAL] &&
+           (pMeter->sinceReport >= configValues[CONFIG_METER_REPORT_INTERVAL])))
+      {
+        meterReportPending |= (BYTE)(1 << relay);
+      }
+    }
+  }
+  if (meterReportPending && !AssocGroupEmpty(ASSOC_GROUP_LIFELINE))
+  {
+    AppRequestSendNext();
+  }
+  else
+  {
+    meterReportPending = 0;
+  }
 }
 
 
 /**
- * @brief See description for function prototype in ZW_basis_api.h.
+ * @brief Writes a Meter Report v3.
+ * @param pFrame Destination buffer.
+ * @param relay Relay index.
+ * @param scale METER_SCALE_KWH or METER_SCALE_W.
+ * @param deltaTime Seconds since the previous energy report, 0 for none.
+ * @return Frame length.
  */
-void
-ApplicationPoll(void)
+static BYTE
+MeterReportBuild(BYTE *pFrame, BYTE relay, BYTE scale, WORD deltaTime)
 {
-#ifdef WATCHDOG_ENABLED
-  ZW_WatchDogKick(); 
-#endif
+  METER_RELAY *pMeter = &meter[relay];
+  BYTE *p = pFrame;
 
-  TaskApplicationPoll();
+  *p++ = COMMAND_CLASS_METER;
+  *p++ = METER_REPORT_V3;
+  *p++ = (METER_RATE_IMPORT << 5) | METER_TYPE_ELECTRIC;
+  if (METER_SCALE_W == scale)
+  {
+    *p++ = (METER_POWER_PRECISION << 5) | (METER_SCALE_W << 3) | METER_POWER_SIZE;
+    *p++ = (BYTE)(pMeter->power >> 8);
+    *p++ = (BYTE)pMeter->power;
+    *p++ = 0;
+    *p++ = 0;
+    return (BYTE)(p - pFrame);
+  }
+  *p++ = (METER_ENERGY_PRECISION << 5) | (METER_SCALE_KWH << 3) | METER_ENERGY_SIZE;
+  *p++ = (BYTE)(pMeter->energy >> 24);
+  *p++ = (BYTE)(pMeter->energy >> 16);
+  *p++ = (BYTE)(pMeter->energy >> 8);
+  *p++ = (BYTE)pMeter->energy;
+  *p++ = (BYTE)(deltaTime >> 8);
+  *p++ = (BYTE)deltaTime;
+  if (deltaTime)
+  {
+    *p++ = (BYTE)(pMeter->energyReported >> 24);
+    *p++ = (BYTE)(pMeter->energyReported >> 16);
+    *p++ = (BYTE)(pMeter->energyReported >> 8);
+    *p++ = (BYTE)pMeter->energyReported;
+  }
+  return (BYTE)(p - pFrame);
+}
+
+
+/**
+ * @brief Sends the lowest pending meter report to the lifeline, from the
+ * endpoint of the relay.
+ * @return TRUE if the request buffer is now in use, FALSE if nothing was
+ * started.
+ */
+static BOOL
+MeterReportSendNext(void)
+{
+  ZW_APPLICATION_TX_BUFFER *pTxBuf;
+  METER_RELAY *pMeter;
+  BYTE *pFrame;
+  BYTE len;
+  BYTE bit;
+  BYTE relay;
+
+  for (bit = 0; bit < 8; bit++)
+  {
+    if (0 == (meterReportPending & (1 << bit)))
+    {
+      continue;
+    }
+    pTxBuf = GetRequestBuffer(ZCB_AppRequestDone);
+    if (IS_NULL(pTxBuf))
+    {
+      appRequestBusy = TRUE;
+      return TRUE;
+    }
+    meterReportPending &= ~(BYTE)(1 << bit);
+    relay = bit & (METER_PENDING_POWER_SHIFT - 1);
+    pMeter = &meter[relay];
+    pFrame = (BYTE *)pTxBuf;
+    if (bit >= METER_PENDING_POWER_SHIFT)
+    {
+      len = MeterReportBuild(pFrame, relay, METER_SCALE_W, 0);
+      pMeter->powerReported = pMeter->power;
+    }
+    else
+    {
+      len = MeterReportBuild(pFrame, relay, METER_SCALE_KWH, pMeter->sinceReport);
+      pMeter->energyReported = pMeter->energy;
+      pMeter->sinceReport = 0;
+    }
+    pMeter->holdoff = METER_REPORT_HOLDOFF;
+
+    if (JOB_STATUS_SUCCESS == ZW_TransportMulticast_SendRequest(
+                                pFrame,
+                                len,
+                                FALSE,
+                                ReqNodeList(&lifelineProfile,
+                                            (CMD_CLASS_GRP *)&(pTxBuf->ZW_Common.cmdClass),
+                                            relay),
+                                ZCB_RequestJobStatus))
+    {
+      return TRUE;
+    }
+    /*No lifeline or transport failure, drop this report*/
+    FreeRequestBuffer();
+  }
+  return FALSE;
 }
 
 
 /**
- * @brief See description for function prototype in ZW_TransportEndpoint.h.
+ * @brief Handler for the Meter command class, version 3. Endpoint n
+ * reports relay n + 1, as for Binary Switch.
+ * @param rxOpt Receive options.
+ * @param pCmd Received frame.
+ * @param cmdLength Length of the received frame.
+ * @return Frame status for the transport layer.
  */
 received_frame_status_t
-Transport_ApplicationCommandHandlerEx(
+handleCommandClassMeter(
   RECEIVE_OPTIONS_TYPE_EX *rxOpt,
   ZW_APPLICATION_TX_BUFFER *pCmd,
   BYTE cmdLength)
 {
-  received_frame_status_t frame_status = RECEIVED_FRAME_STATUS_NO_SUPPORT;
-  ZW_DEBUG_APP_SEND_NL();
-  ZW_DEBUG_APP_SEND_STR("\nTransport_ApplicationCommandHandlerEx()");
-  ZW_DEBUG_APP_SEND_NUM(pCmd->ZW_Common.cmdClass);
+  BYTE *pFrame = (BYTE *)pCmd;
+  ZW_APPLICATION_TX_BUFFER *pTxBuf;
+  BYTE *pReport;
+  BYTE relay = rxOpt->destNode.endpoint;
+  BYTE scale;
 
-  /* Call command class handlers */
-  switch (pCmd->ZW_Common.cmdClass)
+  if ((cmdLength < 2) || (relay >= RELAY_COUNT))
   {
-    case COMMAND_CLASS_VERSION:
-			ZW_DEBUG_APP_SEND_STR("->VERSION");
-      frame_status = handleCommandClassVersion(rxOpt, pCmd, cmdLength);
-      break;
-
-#ifdef BOOTLOADER_ENABLED
-    case COMMAND_CLASS_FIRMWARE_UPDATE_MD_V2:
-			ZW_DEBUG_APP_SEND_STR("\n->MD_V2");
-      frame_status = handleCommandClassFWUpdate(rxOpt, pCmd, cmdLength);
-      break;
-#endif
-
-    case COMMAND_CLASS_ASSOCIATION_GRP_INFO:
-			ZW_DEBUG_APP_SEND_STR("\n->INFO");
-      frame_status = handleCommandClassAssociationGroupInfo( rxOpt, pCmd, cmdLength);
-      break;
-
-    case COMMAND_CLASS_ASSOCIATION:
-			ZW_DEBUG_APP_SEND_STR("\n->ASSOCIATION");
-			frame_status = handleCommandClassAssociation(rxOpt, pCmd, cmdLength);
-      break;
-
-    case COMMAND_CLASS_POWERLEVEL:
-			ZW_DEBUG_APP_SEND_STR("\n->POWERLEVEL");
-      frame_status = handleCommandClassPowerLevel(rxOpt, pCmd, cmdLength);
-      break;
-
-    case COMMAND_CLASS_MANUFACTURER_SPECIFIC:
-			ZW_DEBUG_APP_SEND_STR("\n->SPECIFIC");
-      frame_status = handleCommandClassManufacturerSpecific(rxOpt, pCmd, cmdLength);
-      break;
-
-    case COMMAND_CLASS_ZWAVEPLUS_INFO:
-			ZW_DEBUG_APP_SEND_STR("\n->ZWAVEPLUS_INFO");
-      frame_status = handleCommandClassZWavePlusInfo(rxOpt, pCmd, cmdLength);
-      break;
-
-    case COMMAND_CLASS_BASIC:
-			ZW_DEBUG_APP_SEND_STR("\n->BASIC");
-      frame_status = handleCommandClassBasic(rxOpt, pCmd, cmdLength);
-      break;
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
 
-    case COMMAND_CLASS_SWITCH_BINARY:
-			ZW_DEBUG_APP_SEND_STR("\n->BINARY");
-      frame_status = handleCommandClassBinarySwitch(rxOpt, pCmd, cmdLength);
-      break;
+  if (METER_RESET_V3 == pFrame[1])
+  {
+    memset((BYTE *)&meter[relay], 0, sizeof(METER_RELAY));
+    NvmMarkDirty(NVM_DIRTY_METER);
+    return RECEIVED_FRAME_STATUS_SUCCESS;
+  }
 
-    case COMMAND_CLASS_SWITCH_ALL:
-			ZW_DEBUG_APP_SEND_STR("\n->SWITCH_ALL");
-      frame_status = handleCommandClassSwitchAll(rxOpt, pCmd, cmdLength);
-      break;
+  if (TRUE == Check_not_legal_response_job(rxOpt))
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
 
-    case COMMAND_CLASS_SUPERVISION:
-			ZW_DEBUG_APP_SEND_STR("\n->SUPERVISION");
-      frame_status = handleCommandClassSupervision(rxOpt, pCmd, cmdLength);
-      break;
+  switch (pFrame[1])
+  {
+    case METER_GET_V3:
+      scale = (cmdLength > 2) ? ((pFrame[2] >> 3) & 0x07) : METER_SCALE_KWH;
+      if (METER_SCALE_W != scale)
+      {
+        /* Unsupported scales are answered with the default scale */
+        scale = METER_SCALE_KWH;
+      }
+      pTxBuf = GetResponseBuffer();
+      if (IS_NULL(pTxBuf))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      return SendAppResponse(rxOpt, pTxBuf, MeterReportBuild((BYTE *)pTxBuf, relay, scale, 0));
 
-    case COMMAND_CLASS_MULTI_CHANNEL_ASSOCIATION_V2:
-			ZW_DEBUG_APP_SEND_STR("\n->ASSOCIATION_V2");
-      frame_status = handleCommandClassMultiChannelAssociation(rxOpt, pCmd, cmdLength);
-      break;
+    case METER_SUPPORTED_GET_V3:
+      pTxBuf = GetResponseBuffer();
+      if (IS_NULL(pTxBuf))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pReport = (BYTE *)pTxBuf;
+      pReport[0] = COMMAND_CLASS_METER;
+      pReport[1] = METER_SUPPORTED_REPORT_V3;
+      /* Meter Reset supported, bits 6-5 are reserved in v3 */
+      pReport[2] = 0x80 | METER_TYPE_ELECTRIC;
+      pReport[3] = METER_SCALES_SUPPORTED;
+      return SendAppResponse(rxOpt, pTxBuf, 4);
   }
-  return frame_status;
+  return RECEIVED_FRAME_STATUS_NO_SUPPORT;
 }
+#endif /* APP_FEATURE_METER */
 
 
+#ifdef APP_FACTORY_MODE
 /**
- * @brief See description for function prototype in CommandClassVersion.h.
+ * @brief Listens for a factory frame for FACTORY_ENTRY_TICKS after startup.
+ * Only a node outside a network can enter factory mode.
  */
-BYTE
-handleCommandClassVersionAppl( BYTE cmdClass )
+static void
+FactoryWindowOpen(void)
 {
-  BYTE commandClassVersion = UNKNOWN_VERSION;
-  ZW_DEBUG_APP_SEND_STR("\nhandleCommandClassVersionAppl()");
-  switch (cmdClass)
+  if (0 != myNodeID)
   {
-    case COMMAND_CLASS_VERSION:
-			ZW_DEBUG_APP_SEND_STR("\n->VERSION");
-      commandClassVersion = CommandClassVersionVersionGet();
-      break;
-
-#ifdef BOOTLOADER_ENABLED
-    case COMMAND_CLASS_FIRMWARE_UPDATE_MD:
-			ZW_DEBUG_APP_SEND_STR("\n->MD");
-      commandClassVersion = CommandClassFirmwareUpdateMdVersionGet();
-      break;
-#endif
-
-    case COMMAND_CLASS_POWERLEVEL:
-			ZW_DEBUG_APP_SEND_STR("\n->POWERLEVEL");
-      commandClassVersion = CommandClassPowerLevelVersionGet();
-      break;
-
-    case COMMAND_CLASS_MANUFACTURER_SPECIFIC:
-			ZW_DEBUG_APP_SEND_STR("\n->SPECIFIC");
-      commandClassVersion = CommandClassManufacturerVersionGet();
-      break;
-
-    case COMMAND_CLASS_ASSOCIATION:
-			ZW_DEBUG_APP_SEND_STR("\n->ASSOCIATION");
-     commandClassVersion = CommandClassAssociationVersionGet();
-      break;
-
-    case COMMAND_CLASS_ASSOCIATION_GRP_INFO:
-			ZW_DEBUG_APP_SEND_STR("\n->INFO");
-     commandClassVersion = CommandClassAssociationGroupInfoVersionGet();
-      break;
-
-    case COMMAND_CLASS_DEVICE_RESET_LOCALLY:
-			ZW_DEBUG_APP_SEND_STR("\n->LOCALLY");
-     commandClassVersion = CommandClassDeviceResetLocallyVersionGet();
-      break;
-
-    case COMMAND_CLASS_ZWAVEPLUS_INFO:
-			ZW_DEBUG_APP_SEND_STR("\n->ZWAVEPLUS_INFO");
-     commandClassVersion = CommandClassZWavePlusVersion();
-      break;
-    case COMMAND_CLASS_BASIC:
-			ZW_DEBUG_APP_SEND_STR("\n->BASIC");
-     commandClassVersion =  CommandClassBasicVersionGet();
-      break;
-    case COMMAND_CLASS_SWITCH_BINARY:
-			ZW_DEBUG_APP_SEND_STR("\n->BINARY");
-     commandClassVersion = CommandClassBinarySwitchVersionGet();
-      break;
-
-    case COMMAND_CLASS_SWITCH_ALL:
-			ZW_DEBUG_APP_SEND_STR("\n->SWITCH_ALL");
-     commandClassVersion = CommandClassSwitchAllVersionGet();
-      break;
-
-    case COMMAND_CLASS_MULTI_CHANNEL_ASSOCIATION_V2:
-			ZW_DEBUG_APP_SEND_STR("\n->ASSOCIATION_V2");
-      commandClassVersion = CmdClassMultiChannelAssociationVersion();
-      break;
-
-    case COMMAND_CLASS_SUPERVISION:
-			ZW_DEBUG_APP_SEND_STR("\n->SUPERVISION");
-      commandClassVersion = CommandClassSupervisionVersionGet();
-      break;
-
-    default:
-			ZW_DEBUG_APP_SEND_STR("\n->default");
-     commandClassVersion = ZW_Transport_CommandClassVersionGet(cmdClass);
+    return;
   }
-  return commandClassVersion;
+  FACTORY_UART_INIT();
+  factoryWindowOpen = TRUE;
+  factoryWindowTimer = ZW_TIMER_START(ZCB_FactoryWindowClose, FACTORY_ENTRY_TICKS, TIMER_ONE_TIME);
 }
 
 
 /**
- * @brief See description for function prototype in ZW_slave_api.h.
+ * @brief Ends the factory mode entry window.
  */
-void
-ApplicationSlaveUpdate(
-  BYTE bStatus,
-  BYTE bNodeID,
-  BYTE* pCmd,
-  BYTE bLen)
+PCB(ZCB_FactoryWindowClose)(void)
 {
-  UNUSED(bStatus);
-  UNUSED(bNodeID);
-  UNUSED(pCmd);
-  UNUSED(bLen);
+  factoryWindowTimer = APP_TIMER_NONE;
+  factoryWindowOpen = FALSE;
 }
 
 
 /**
- * @brief See description for function prototype in slave_learn.h.
+ * @brief Records key events while in factory mode.
+ * @param event Event received in STATE_APP_FACTORY.
  */
-void
-LearnCompleted(BYTE bNodeID)
+static void
+FactoryKeyEvent(EVENT_APP event)
 {
-  ZW_DEBUG_APP_SEND_NL();
-  ZW_DEBUG_APP_SEND_STR("LearnCompleted()");
-  ZW_DEBUG_APP_SEND_NUM(bNodeID);
-  /*If bNodeID= 0xff.. learn mode failed*/
-  if(bNodeID != NODE_BROADCAST)
+  BYTE mask = 0;
+
+  if ((EVENT_KEY1_DOWN == event) || (EVENT_KEY1_UP == event))
   {
-    /*Success*/
-    myNodeID = bNodeID;
-    if (0 == myNodeID)
-    {
-      /*Clear association*/
-      AssociationInit(TRUE);
-      SetDefaultConfiguration();
-    }
+    mask = 0x01;
+  }
+  else if ((EVENT_KEY2_DOWN == event) || (EVENT_KEY2_UP == event))
+  {
+    mask = 0x02;
+  }
+  else if ((EVENT_KEY3_DOWN == event) || (EVENT_KEY3_UP == event))
+  {
+    mask = 0x04;
+  }
+  if ((EVENT_KEY1_DOWN == event) || (EVENT_KEY2_DOWN == event) || (EVENT_KEY3_DOWN == event))
+  {
+    factoryKeysDown |= mask;
+    factoryKeysPressed |= mask;
+  }
+  else
+  {
+    factoryKeysDown &= ~mask;
   }
-  ZCB_EventSchedulerEventAdd((EVENT_APP) EVENT_SYSTEM_LEARNMODE_FINISH);
-  Transport_OnLearnCompleted(bNodeID);
 }
 
 
 /**
- * @brief Returns the Z-Wave node ID.
- * @return BYTE NodeID
+ * @brief NVM write callback of FACTORY_CMD_NVM_WRITE.
  */
-BYTE
-GetMyNodeID(void)
+void ZCB_FactoryNvmWritten(void);
+void ZCB_FactoryNvmTestWritten(void);
+PCB(ZCB_FactoryNvmWritten)(void)
 {
-	return myNodeID;
+  factoryNvmBusy = FALSE;
 }
 
 
 /**
- * @brief Returns the current state of the application state machine.
- * @return Current state
+ * @brief Writes the next NVM self-test pattern to the scratch byte.
+ * @param pattern Pattern to write.
  */
-STATE_APP
-GetAppState(void)
+static void
+FactoryNvmTestWrite(BYTE pattern)
 {
-  return currentState;
+  factoryNvmTest = (0x55 == pattern) ? FACTORY_NVM_TEST_WRITE_55 : FACTORY_NVM_TEST_WRITE_AA;
+  factoryNvmBuffer[0] = pattern;
+  factoryNvmBusy = TRUE;
+  if (!MemoryPutBuffer((WORD)&EEOFFSET_APP_far.factoryScratch, factoryNvmBuffer, 1,
+                       ZCB_FactoryNvmTestWritten))
+  {
+    factoryNvmBusy = FALSE;
+    factoryNvmTest = FACTORY_NVM_TEST_FAIL;
+  }
 }
 
+
 /**
- * @brief The core state machine of this sample application.
- * @param event The event that triggered the call of AppStateManager.
+ * @brief NVM write callback of the self-test. Reads the pattern back once
+ * it is written and writes the next one.
  */
-void
-AppStateManager(EVENT_APP event)
+PCB(ZCB_FactoryNvmTestWritten)(void)
 {
-  ZW_DEBUG_APP_SEND_NL();
-  ZW_DEBUG_APP_SEND_STR("AppStateManager()");
-  ZW_DEBUG_APP_SEND_NUM(event);
-  ZW_DEBUG_APP_SEND_STR("s");
-  ZW_DEBUG_APP_SEND_NUM(currentState);
+  BYTE pattern = (FACTORY_NVM_TEST_WRITE_55 == factoryNvmTest) ? 0x55 : 0xAA;
 
-  if(EVENT_SYSTEM_WATCHDOG_RESET == event)
+  factoryNvmBusy = FALSE;
+  if (MemoryGetByte((WORD)&EEOFFSET_APP_far.factoryScratch) != pattern)
   {
-    /*Force state change to activate watchdog-reset without taking care of current
-      state.*/
-    ChangeState(STATE_APP_WATCHDOG_RESET);
+    factoryNvmTest = FACTORY_NVM_TEST_FAIL;
   }
-
-  switch(currentState)
+  else if (0x55 == pattern)
   {
-    case STATE_APP_STARTUP:
-			ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_STARTUP");
-      ChangeState(STATE_APP_IDLE);
-      break;
+    FactoryNvmTestWrite(0xAA);
+  }
+  else
+  {
+    factoryNvmTest = FACTORY_NVM_TEST_PASS;
+  }
+}
 
-    case STATE_APP_IDLE:
-			ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_IDLE");
-		  if(event == EVENT_SYSTEM_LEARNMODE_START) {
-					if(myNodeID) {
-						ZW_DEBUG_APP_SEND_STR("LEARN_MODE_EXCLUSION");
-						StartLearnModeNow(LEARN_MODE_EXCLUSION_NWE);
-					}
-					else{
-						ZW_DEBUG_APP_SEND_STR("LEARN_MODE_INCLUSION");
-						StartLearnModeNow(LEARN_MODE_INCLUSION);
-					}
-					ChangeState(STATE_APP_LEARN_MODE);
-					led_nwk_on();
-					return;
+
+/**
+ * @brief Runs the self-tests. A new run starts the NVM write and
+ * read-back.
+ * While the NVM test runs only FACTORY_TEST_NVM_PENDING is added; the
+ * call after it completes reports its result and ends the run. A key
+ * stuck down is reported by every call.
+ * @return FACTORY_TEST_* bits.
+ */
+static BYTE
+FactorySelfTest(void)
+{
+  BYTE result = 0;
+
+  switch (factoryNvmTest)
+  {
+    case FACTORY_NVM_TEST_IDLE:
+      if (factoryNvmBusy)
+      {
+        /* FACTORY_CMD_NVM_WRITE still running, start on the next call */
+        result |= FACTORY_TEST_NVM_PENDING;
+        break;
+      }
+      FactoryNvmTestWrite(0x55);
+      if (FACTORY_NVM_TEST_FAIL == factoryNvmTest)
+      {
+        result |= FACTORY_TEST_NVM;
+        factoryNvmTest = FACTORY_NVM_TEST_IDLE;
+      }
+      else
+      {
+        result |= FACTORY_TEST_NVM_PENDING;
       }
-			else if(event == EVENT_KEY1_DOWN || 
-							event == EVENT_KEY2_DOWN || 
-						  event == EVENT_KEY3_DOWN) { 
-				ZW_DEBUG_APP_SEND_STR("\nEVENT_KEY_DOWN"); 
-				switch_state.tmr_handle = ZW_TIMER_START(cb_timer_5s,500,1); //500*10=5s
-				switch_state.learn = 0;
-			}
-			else if(event == EVENT_KEY1_UP) { 
-				ZW_DEBUG_APP_SEND_STR("\nEVENT_KEY1_UP"); 
-				if(switch_state.learn == 0) {
-					ZW_TIMER_CANCEL(switch_state.tmr_handle);
-					s1_state_set(!switch_state.s1);
-				}
-			}
-			else if(event == EVENT_KEY2_UP) { 
-				ZW_DEBUG_APP_SEND_STR("\nEVENT_KEY2_UP"); 
-				if(switch_state.learn == 0) {
-					ZW_TIMER_CANCEL(switch_state.tmr_handle);
-					s2_state_set(!switch_state.s2);
-				}
-			}
-			else if(event == EVENT_KEY3_UP) { 
-				ZW_DEBUG_APP_SEND_STR("\nEVENT_KEY3_UP"); 
-				if(switch_state.learn == 0) {
-					ZW_TIMER_CANCEL(switch_state.tmr_handle);
-					s3_state_set(!switch_state.s3);
-				}
-			}
       break;
 
-    case STATE_APP_LEARN_MODE:
-			ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_LEARN_MODE");
-		  if(event == EVENT_SYSTEM_LEARNMODE_END) {
-				ZW_DEBUG_APP_SEND_STR("\nEVENT_SYSTEM_LEARNMODE_END");
-				StartLearnModeNow(LEARN_MODE_DISABLE);
-        ChangeState(STATE_APP_IDLE);
-				led_nwk_off();
-			}
-      else if(event == EVENT_SYSTEM_LEARNMODE_FINISH) {
-        ZW_DEBUG_APP_SEND_STR("\nEVENT_SYSTEM_LEARNMODE_FINISH");
-        ChangeState(STATE_APP_IDLE);
-				led_nwk_off();
-      }
+    case FACTORY_NVM_TEST_PASS:
+      factoryNvmTest = FACTORY_NVM_TEST_IDLE;
       break;
 
-    case STATE_APP_WATCHDOG_RESET:
-      if(EVENT_APP_REFRESH_MMI == event){}
-      ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_WATCHDOG_RESET");
-      ZW_WatchDogEnable(); /*reset asic*/
-      for (;;) {}
+    case FACTORY_NVM_TEST_FAIL:
+      result |= FACTORY_TEST_NVM;
+      factoryNvmTest = FACTORY_NVM_TEST_IDLE;
       break;
 
-    case STATE_APP_OTA:
-			ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_OTA");
-      if(EVENT_APP_REFRESH_MMI == event){}
+    default:
+      result |= FACTORY_TEST_NVM_PENDING;
       break;
+  }
 
-#ifdef BOOTLOADER_ENABLED
-    case STATE_APP_OTA_HOST:
-		  ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_OTA_HOST");
-      if(EVENT_APP_REFRESH_MMI == event) { }
-      if(EVENT_APP_OTA_HOST_WRITE_DONE == event)
+  if (factoryKeysDown)
+  {
+    result |= FACTORY_TEST_KEYS;
+  }
+  return result;
+}
+
+
+/**
+ * @brief Executes a received factory command and builds its response data.
+ * @param pData Response data after the status byte.
+ * @param pLen Set to the response data length.
+ * @return FACTORY_STATUS_* of the command.
+ */
+static BYTE
+FactoryCommand(BYTE *pData, BYTE *pLen)
+{
+  BYTE *pParam = &factoryRx[1];
+  BYTE paramLen = factoryRxLength - 1;
+  WORD offset;
+  BYTE len;
+
+  *pLen = 0;
+  switch (factoryRx[0])
+  {
+    case FACTORY_CMD_PING:
+      pData[0] = APP_VERSION;
+      pData[1] = APP_REVISION;
+      pData[2] = FACTORY_PROTOCOL_VERSION;
+      *pLen = 3;
+      return FACTORY_STATUS_OK;
+
+    case FACTORY_CMD_RELAYS:
+      if (paramLen < 2)
       {
-        ZW_DEBUG_SEND_STR("\nEVENT_APP_OTA_HOST_WRITE_DONE");
-        OtaHostFWU_WriteFinish();
+        return FACTORY_STATUS_PARAM;
       }
-      if(EVENT_APP_OTA_HOST_STATUS == event)
+      relays_state_set(pParam[0] & RELAY_MASK_ALL, pParam[1]);
+      pData[0] = relays_state_get();
+      *pLen = 1;
+      return FACTORY_STATUS_OK;
+
+    case FACTORY_CMD_LED:
+      if (paramLen < 1)
       {
-        ZW_DEBUG_SEND_STR("\nEVENT_APP_OTA_HOST_STATUS");
-        userReboot = FALSE;
-        OtaHostFWU_Status(userReboot, TRUE);
+        return FACTORY_STATUS_PARAM;
       }
-      break;
-#endif
+      if (pParam[0])
+      {
+        led_nwk_on();
+      }
+      else
+      {
+        led_nwk_off();
+      }
+      return FACTORY_STATUS_OK;
+
+    case FACTORY_CMD_KEYS:
+      pData[0] = factoryKeysDown;
+      pData[1] = factoryKeysPressed;
+      factoryKeysPressed = 0;
+      *pLen = 2;
+      return FACTORY_STATUS_OK;
+
+    case FACTORY_CMD_NVM_READ:
+      if ((paramLen < 3) || (pParam[2] > FACTORY_DATA_MAX))
+      {
+        return FACTORY_STATUS_PARAM;
+      }
+      offset = ((WORD)pParam[0] << 8) | pParam[1];
+      MemoryGetBuffer(offset, pData, pParam[2]);
+      *pLen = pParam[2];
+      return FACTORY_STATUS_OK;
+
+    case FACTORY_CMD_NVM_WRITE:
+      if ((paramLen < 3) || ((paramLen - 2) > FACTORY_DATA_MAX))
+      {
+        return FACTORY_STATUS_PARAM;
+      }
+      if (factoryNvmBusy)
+      {
+        return FACTORY_STATUS_BUSY;
+      }
+      offset = ((WORD)pParam[0] << 8) | pParam[1];
+      len = paramLen - 2;
+      memcpy(factoryNvmBuffer, &pParam[2], len);
+      factoryNvmBusy = TRUE;
+      if (!MemoryPutBuffer(offset, factoryNvmBuffer, len, ZCB_FactoryNvmWritten))
+      {
+        factoryNvmBusy = FALSE;
+        return FACTORY_STATUS_BUSY;
+      }
+      return FACTORY_STATUS_OK;
+
+    case FACTORY_CMD_NODE_INFO:
+      MemoryGetID(pData, &pData[4]);
+      keystore_public_key_read(factoryPublicKey);
+      /* The DSK is the first 16 bytes of the public key */
+      memcpy(&pData[5], factoryPublicKey, 16);
+      *pLen = 21;
+      return FACTORY_STATUS_OK;
+
+    case FACTORY_CMD_SELF_TEST:
+      pData[0] = FactorySelfTest();
+      pData[1] = relays_state_get();
+      *pLen = 2;
+      return FACTORY_STATUS_OK;
+
+    case FACTORY_CMD_EXIT:
+      ChangeState(STATE_APP_IDLE);
+      SmartStartSchedule();
+      return FACTORY_STATUS_OK;
   }
+  return FACTORY_STATUS_UNKNOWN;
 }
 
 
 /**
- * @brief Sets the current state to a new, given state.
- * @param newState New state.
+ * @brief Sends a factory response frame from factoryTx.
+ * @param cmd Command answered.
+ * @param status FACTORY_STATUS_* byte.
+ * @param len Length of the data after the status byte.
  */
 static void
-ChangeState(STATE_APP newState)
+FactoryRespond(BYTE cmd, BYTE status, BYTE len)
 {
-  ZW_DEBUG_APP_SEND_STR("\nChangeState(");
-  ZW_DEBUG_APP_SEND_NUM(newState);
-	ZW_DEBUG_APP_SEND_STR(")");
+  BYTE checksum;
+  BYTE i;
+
+  factoryTx[0] = cmd | FACTORY_RESPONSE;
+  factoryTx[1] = status;
+  len += 2;
+  FACTORY_UART_TX(FACTORY_SOF);
+  FACTORY_UART_TX(len);
+  checksum = 0xFF ^ len;
+  for (i = 0; i < len; i++)
+  {
+    FACTORY_UART_TX(factoryTx[i]);
+    checksum ^= factoryTx[i];
+  }
+  FACTORY_UART_TX(checksum);
+}
 
-  currentState = newState;
-  ZCB_EventSchedulerEventAdd(EVENT_APP_REFRESH_MMI);
+
+/**
+ * @brief Receives factory frames. The first valid frame inside the entry
+ * window switches to STATE_APP_FACTORY; outside factory mode and the
+ * window the UART is not read.
+ */
+static void
+FactoryPoll(void)
+{
+  BYTE data;
+  BYTE checksum;
+  BYTE i;
+  BYTE status;
+  BYTE len;
+
+  if (!factoryWindowOpen && (STATE_APP_FACTORY != currentState))
+  {
+    return;
+  }
+  while (FACTORY_UART_RX_READY())
+  {
+    data = FACTORY_UART_RX_GET();
+    if ((FACTORY_RX_SOF != factoryRxState) &&
+        ((WORD)(getTickTime() - factoryRxTick) > FACTORY_BYTE_TIMEOUT))
+    {
+      /* Gap inside a frame, resynchronize */
+      factoryRxState = FACTORY_RX_SOF;
+    }
+    factoryRxTick = getTickTime();
+
+    switch (factoryRxState)
+    {
+      case FACTORY_RX_SOF:
+        if (FACTORY_SOF == data)
+        {
+          factoryRxState = FACTORY_RX_LENGTH;
+        }
+        break;
+
+      case FACTORY_RX_LENGTH:
+        if ((0 == data) || (data > FACTORY_FRAME_MAX))
+        {
+          factoryRxState = FACTORY_RX_SOF;
+          break;
+        }
+        factoryRxLength = data;
+        factoryRxCount = 0;
+        factoryRxState = FACTORY_RX_DATA;
+        break;
+
+      case FACTORY_RX_DATA:
+        factoryRx[factoryRxCount++] = data;
+        if (factoryRxCount == factoryRxLength)
+        {
+          factoryRxState = FACTORY_RX_CHECKSUM;
+        }
+        break;
+
+      case FACTORY_RX_CHECKSUM:
+        factoryRxState = FACTORY_RX_SOF;
+        checksum = 0xFF ^ factoryRxLength;
+        for (i = 0; i < factoryRxLength; i++)
+        {
+          checksum ^= factoryRx[i];
+        }
+        if (checksum != data)
+        {
+          FactoryRespond(factoryRx[0], FACTORY_STATUS_CHECKSUM, 0);
+          break;
+        }
+        if (STATE_APP_FACTORY != currentState)
+        {
+          ZW_DEBUG_APP_SEND_STR("\nSTATE_APP_FACTORY");
+          factoryWindowOpen = FALSE;
+          if (APP_TIMER_NONE != factoryWindowTimer)
+          {
+            ZW_TIMER_CANCEL(factoryWindowTimer);
+            factoryWindowTimer = APP_TIMER_NONE;
+          }
+          TimerWheelCancel(&smartStartHandle);
+          ChangeState(STATE_APP_FACTORY);
+        }
+        status = FactoryCommand(&factoryTx[2], &len);
+        FactoryRespond(factoryRx[0], status, len);
+        break;
+    }
+  }
 }
+#endif /* APP_FACTORY_MODE */
+
 
 /**
- * @brief Transmission callback for Device Reset Locally call.
- * @param pTransmissionResult Result of each transmission.
+ * @brief Sends a report built in the response buffer to the originator of a
+ * received frame. The buffer is released if the transmission cannot start.
+ * @param rxOpt Receive options of the frame being answered.
+ * @param pTxBuf Buffer returned by GetResponseBuffer().
+ * @param len Length of the report.
+ * @return Frame status for the transport layer.
  */
-PCB(ZCB_DeviceResetLocallyDone)(TRANSMISSION_RESULT * pTransmissionResult)
+static received_frame_status_t
+SendAppResponse(
+  RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+  ZW_APPLICATION_TX_BUFFER *pTxBuf,
+  BYTE len)
 {
-	ZW_DEBUG_APP_SEND_STR("\nZCB_DeviceResetLocallyDone()");
-	
-  if (TRANSMISSION_RESULT_FINISHED == pTransmissionResult->isFinished)
+  TRANSMIT_OPTIONS_TYPE_SINGLE_EX *pTxOptionsEx;
+
+  RxToTxOptions(rxOpt, &pTxOptionsEx);
+  if (ZW_TX_IN_PROGRESS != Transport_SendResponseEP((BYTE *)pTxBuf,
+                                                    len,
+                                                    pTxOptionsEx,
+                                                    ZCB_ResponseJobStatus))
   {
-    ZW_DEBUG_APP_SEND_NL();
-    ZW_DEBUG_APP_SEND_STR("DRLD");
+    /*Job failed, free transmit-buffer pTxBuf by clearing mutex */
+    FreeResponseBuffer();
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
+  return RECEIVED_FRAME_STATUS_SUCCESS;
+}
 
-    ZCB_EventSchedulerEventAdd((EVENT_APP) EVENT_SYSTEM_WATCHDOG_RESET);
+
+/**
+ * @brief Answers a Get with a static report from code memory.
+ * @param rxOpt Receive options of the Get.
+ * @param id Report to send.
+ * @return Frame status for the transport layer.
+ */
+static received_frame_status_t
+ResponseCacheSend(RECEIVE_OPTIONS_TYPE_EX *rxOpt, RESPONSE_CACHE_ID id)
+{
+  ZW_APPLICATION_TX_BUFFER *pTxBuf = GetResponseBuffer();
+
+  if (IS_NULL(pTxBuf))
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
   }
+  memcpy((BYTE *)pTxBuf, responseCache[id].pReport, responseCache[id].length);
+  return SendAppResponse(rxOpt, pTxBuf, responseCache[id].length);
 }
 
-#ifdef BOOTLOADER_ENABLED
+#ifdef APP_DIAGNOSTICS
 /**
- * @brief Called when OTA firmware upgrade is finished. Reboots node to cleanup
- * and starts on new FW.
- * @param OTA_STATUS otaStatus
+ * @brief Returns the counter slot of a command class. A free slot is claimed
+ * for a new class; when all are taken the last slot collects the rest.
+ * @param cmdClass Command class of the dispatched frame.
+ * @return Pointer to the slot.
  */
-PCB(ZCB_OTAFinish)(OTA_STATUS otaStatus)
+static DIAG_CLASS_STAT *
+DiagClassSlot(BYTE cmdClass)
 {
-	ZW_DEBUG_APP_SEND_STR("\nZCB_OTAFinish()");
-	
-  UNUSED(otaStatus);
-  if (STATE_APP_OTA_HOST == GetAppState())
+  BYTE i;
+
+  for (i = 0; i < (DIAG_CLASS_SLOTS - 1); i++)
   {
-    ChangeState(STATE_APP_IDLE);
-    if (userReboot)
+    if (diag.classStat[i].cmdClass == cmdClass)
     {
-      userReboot = FALSE;
-      return;
+      return &diag.classStat[i];
+    }
+    if (0 == diag.classStat[i].frames)
+    {
+      diag.classStat[i].cmdClass = cmdClass;
+      return &diag.classStat[i];
     }
   }
-  if (OTA_STATUS_DONE == otaStatus)
-  {
-  /*Just reboot node to cleanup and start on new FW.*/
-    ZW_WatchDogEnable(); /*reset asic*/
-    while(1);
-  }
+  diag.classStat[DIAG_CLASS_SLOTS - 1].cmdClass = 0xFF;
+  return &diag.classStat[DIAG_CLASS_SLOTS - 1];
 }
 
 
 /**
- * @brief Function pointer for KEIL.
+ * @brief Records the start time of a frame dispatch.
  */
-code const BOOL (code * ZCB_OTAStart_p)(void) = &ZCB_OTAStart;
+void
+DiagFrameBegin(void)
+{
+  diag.frameStart = DIAG_CLOCK();
+}
+
+
 /**
- * @brief Called before OTA firmware upgrade starts.
- * @details Checks whether the application is ready for a firmware upgrade.
- * @return FALSE if OTA should be rejected, otherwise TRUE.
+ * @brief Counts a dispatched frame and places its handler time in a log2
+ * bucket: 0, 1, 2-3, 4-7, 8-15 and 16 or more clock units. The slowest
+ * frame is kept so its input can be replayed.
+ * @param pFrame Dispatched frame.
+ * @param len Length of the frame.
  */
-BOOL
-ZCB_OTAStart(void)
+void
+DiagFrameEnd(BYTE *pFrame, BYTE len)
 {
-  BOOL  status = FALSE;
-	
-	ZW_DEBUG_APP_SEND_STR("\nZCB_OTAStart()");
-	
-  if (STATE_APP_IDLE == GetAppState())
+  WORD elapsed = DIAG_CLOCK() - diag.frameStart;
+  DIAG_CLASS_STAT *pStat = DiagClassSlot(pFrame[0]);
+  BYTE bucket = 0;
+
+  if (elapsed > pStat->maxTime)
   {
-    ZCB_EventSchedulerEventAdd((EVENT_APP) EVENT_SYSTEM_OTA_START);
-    status = TRUE;
+    pStat->maxTime = elapsed;
+  }
+  if (elapsed > diag.worstTime)
+  {
+    diag.worstTime = elapsed;
+    diag.worstLength = len;
+    memcpy(diag.worstFrame, pFrame, (len < DIAG_WORST_BYTES) ? len : DIAG_WORST_BYTES);
+  }
+
+  while (elapsed && (bucket < (DIAG_HIST_BUCKETS - 1)))
+  {
+    elapsed >>= 1;
+    bucket++;
+  }
+  if (0xFFFF != pStat->frames)
+  {
+    pStat->frames++;
+  }
+  if (0xFFFF != pStat->hist[bucket])
+  {
+    pStat->hist[bucket]++;
   }
-  return status;
 }
 
 
 /**
- * @brief Called OTA firmware upgrade want to write an image
- * @param BYTE *pData pointer to the image data to write.
- * @param BYTE len length of the image data
+ * @brief Counts an AppStateManager event per application state.
+ * @param state State the event was received in.
  */
-PCB(ZCB_OTAWrite)(BYTE *pData, BYTE len)
+void
+DiagAppEvent(STATE_APP state)
 {
-  static WORD adr = 0;
-	
-	ZW_DEBUG_APP_SEND_STR("\nZCB_OTAWrite()");
-	
-  UNUSED(pData);
-  if (STATE_APP_IDLE == GetAppState())
+  if ((state < DIAG_STATE_SLOTS) && (0xFFFF != diag.stateEvents[state]))
   {
-    ZW_DEBUG_APP_SEND_NL();
-    ZW_DEBUG_APP_SEND_STR("STATE_APP_OTA_HOST");
-
-    ChangeState(STATE_APP_OTA_HOST);
+    diag.stateEvents[state]++;
   }
-  if (len)
-  {
-    ZW_DEBUG_APP_SEND_STR("W ADR: 0x");
-    ZW_DEBUG_APP_SEND_NUM((BYTE)(adr>>8) & 0xFF);
-    ZW_DEBUG_APP_SEND_NUM((BYTE)(adr & 0x00FF));
-    ZW_DEBUG_APP_SEND_STR(" L: 0x");
-    ZW_DEBUG_APP_SEND_NUM(len);
-    ZW_DEBUG_APP_SEND_BYTE(':');
+}
 
-    adr += len;
-    while(--len)
-    {
-      ZW_DEBUG_APP_SEND_NUM(*pData++);
-    }
-    ZW_DEBUG_APP_SEND_NL();
-    // set event write finish
-    ZCB_EventSchedulerEventAdd(EVENT_APP_OTA_HOST_WRITE_DONE);
 
+/**
+ * @brief Records the start time of an ApplicationPoll iteration.
+ */
+void
+DiagPollBegin(void)
+{
+  diag.pollStart = DIAG_CLOCK();
+}
+
+
+/**
+ * @brief Tracks the longest ApplicationPoll iteration and closes the one
+ * second rate window when it has elapsed.
+ */
+void
+DiagPollEnd(void)
+{
+  WORD elapsed = DIAG_CLOCK() - diag.pollStart;
+
+  if (elapsed > diag.pollMax)
+  {
+    diag.pollMax = elapsed;
   }
-  else
+  diag.pollCount++;
+  if ((WORD)(getTickTime() - diag.windowStart) >= 100)
   {
-    // set event ota host status
-    ZCB_EventSchedulerEventAdd(EVENT_APP_OTA_HOST_STATUS);
+    diag.windowStart = getTickTime();
+    diag.pollsPerSec = diag.pollCount;
+    diag.otaBytesPerSec = diag.otaBytes;
+    diag.otaFragmentsPerSec = diag.otaFragments;
+    diag.pollCount = 0;
+    diag.otaBytes = 0;
+    diag.otaFragments = 0;
   }
-
 }
-#endif
 
 
 /**
- * @brief Handler for basic set.
- *
- * Handles received basic set commands.
- *
- * @param val Parameter dependent of the application device class.
+ * @brief Counts an OTA fragment written by ZCB_OTAWrite().
+ * @param len Fragment length.
  */
 void
-handleBasicSetCommand(BYTE val, BYTE endpoint )
+DiagOtaWrite(BYTE len)
 {
-  CommandClassBinarySwitchSupportSet(val, endpoint);
+  diag.otaBytes += len;
+  diag.otaFragments++;
+  diag.otaBytesTotal += len;
 }
 
 
 /**
- * @brief Handler for basic get. Handles received basic get commands.
+ * @brief Builds a diagnostics page after the report header.
+ * @param pData Start of the page data in the response buffer.
+ * @param page Requested page.
+ * @return Number of data bytes written, 0 if the page does not exist.
  */
-BYTE
-getAppBasicReport( BYTE endpoint )
+static BYTE
+DiagPageBuild(BYTE *pData, BYTE page)
 {
-  return handleAppltBinarySwitchGet(endpoint);
+  BYTE *p = pData;
+  BYTE i;
+
+  if ((DIAG_PAGE_WORST != page) && (DIAG_PAGE_SUMMARY != page) &&
+      ((page - DIAG_PAGE_CLASS_FIRST) >= DIAG_CLASS_SLOTS))
+  {
+    return 0;
+  }
+  *p++ = DIAG_FORMAT_VERSION;
+  if (DIAG_PAGE_WORST == page)
+  {
+    *p++ = (BYTE)(diag.worstTime >> 8);
+    *p++ = (BYTE)diag.worstTime;
+    *p++ = diag.worstLength;
+    for (i = 0; (i < diag.worstLength) && (i < DIAG_WORST_BYTES); i++)
+    {
+      *p++ = diag.worstFrame[i];
+    }
+  }
+  else if (DIAG_PAGE_SUMMARY == page)
+  {
+    *p++ = (BYTE)(diag.pollsPerSec >> 8);
+    *p++ = (BYTE)diag.pollsPerSec;
+    *p++ = (BYTE)(diag.pollMax >> 8);
+    *p++ = (BYTE)diag.pollMax;
+    *p++ = (BYTE)(diag.otaBytesPerSec >> 8);
+    *p++ = (BYTE)diag.otaBytesPerSec;
+    *p++ = diag.otaFragmentsPerSec;
+    *p++ = (BYTE)(diag.otaBytesTotal >> 24);
+    *p++ = (BYTE)(diag.otaBytesTotal >> 16);
+    *p++ = (BYTE)(diag.otaBytesTotal >> 8);
+    *p++ = (BYTE)diag.otaBytesTotal;
+    *p++ = DIAG_CLASS_SLOTS;
+    *p++ = DIAG_STATE_SLOTS;
+    for (i = 0; i < DIAG_STATE_SLOTS; i++)
+    {
+      *p++ = (BYTE)(diag.stateEvents[i] >> 8);
+      *p++ = (BYTE)diag.stateEvents[i];
+    }
+  }
+  else
+  {
+    DIAG_CLASS_STAT *pStat = &diag.classStat[page - DIAG_PAGE_CLASS_FIRST];
+
+    *p++ = pStat->cmdClass;
+    *p++ = (BYTE)(pStat->frames >> 8);
+    *p++ = (BYTE)pStat->frames;
+    *p++ = (BYTE)(pStat->maxTime >> 8);
+    *p++ = (BYTE)pStat->maxTime;
+    for (i = 0; i < DIAG_HIST_BUCKETS; i++)
+    {
+      *p++ = (BYTE)(pStat->hist[i] >> 8);
+      *p++ = (BYTE)pStat->hist[i];
+    }
+  }
+  return (BYTE)(p - pData);
 }
+#endif /* APP_DIAGNOSTICS */
 
 
+#ifdef APP_FEATURE_CRASH_RING
 /**
- * @brief Report the target value
- * @return target value.
+ * @brief Loads the crash record left by the previous run and starts a new
+ * one. The new record is written at once so a watchdog trip before the
+ * first write is not reported with the old record, unless NVM already
+ * holds an empty record.
  */
-BYTE
-getAppBasicReportTarget( BYTE endpoint )
+static void
+CrashRingInit(void)
 {
-  return handleAppltBinarySwitchGet(endpoint);
+  MemoryGetBuffer((WORD)&EEOFFSET_APP_far.crashRecord[0], (BYTE *)&crashPrevious, sizeof(crashPrevious));
+  if (CRASH_RECORD_MAGIC != crashPrevious.magic)
+  {
+    memset((BYTE *)&crashPrevious, 0, sizeof(crashPrevious));
+  }
+  ZW_DEBUG_APP_SEND_STR("\nCrashRingInit ");
+  ZW_DEBUG_APP_SEND_NUM(crashPrevious.resetCause);
+  ZW_DEBUG_APP_SEND_NUM(wakeupReason);
+
+  memset((BYTE *)&crashRecord, 0, sizeof(crashRecord));
+  crashRecord.magic = CRASH_RECORD_MAGIC;
+  if (memcmp((BYTE *)&crashPrevious, (BYTE *)&crashRecord, sizeof(crashRecord)))
+  {
+    CrashRingFlush(CRASH_CAUSE_NONE, NULL);
+  }
 }
 
 
 /**
- * @brief Report transition duration time.
- * @return duration time.
+ * @brief Adds an event to the crash ring in RAM.
+ * @details Events stay in RAM. The record is written after a state change,
+ * every CRASH_RING_FLUSH_INTERVAL while events keep coming, and on the
+ * reset paths. Key and frame events come too often to be written one by
+ * one.
+ * @param kind CRASH_EVENT_APP, CRASH_EVENT_FRAME or CRASH_EVENT_STATE.
+ * @param value Event, command class or new state.
  */
-BYTE
-getAppBasicReportDuration( BYTE endpoint )
+static void
+CrashRingEvent(BYTE kind, BYTE value)
 {
-  UNUSED(endpoint);
-  return 0;
+  CRASH_EVENT *pEvent = &crashRecord.events[crashRecord.head];
+
+  pEvent->kind = kind;
+  pEvent->value = value;
+  crashRecord.head = (crashRecord.head + 1) & (CRASH_RING_SIZE - 1);
+  crashRecordDirty = TRUE;
 }
 
+
 /**
- * @brief See description for function prototype in CommandClassSwitchAll.h.
- */ 
-void handleSwitchAll(CMD_CLASS_SWITCHALL_SET val, BYTE endpoint)
+ * @brief Writes the crash record to NVM.
+ * @param resetCause CRASH_CAUSE_* of a reset about to happen, or
+ * CRASH_CAUSE_NONE for a write while running.
+ * @param pCallback Called when the write is done, or at once if it cannot
+ * be started. May be NULL.
+ */
+static void
+CrashRingFlush(BYTE resetCause, VOID_CALLBACKFUNC(pCallback)(void))
 {
-	UNUSED(endpoint);
-	s1_state_set(val);
-	s2_state_set(val);
-	s3_state_set(val);
+  crashRecord.resetCause = resetCause;
+  crashRecordDirty = FALSE;
+  if (!MemoryPutBuffer((WORD)&EEOFFSET_APP_far.crashRecord[0], (BYTE *)&crashRecord,
+                       sizeof(crashRecord), pCallback) && (NULL != pCallback))
+  {
+    pCallback();
+  }
 }
+#endif /* APP_FEATURE_CRASH_RING */
 
 
 /**
- * @brief See description for function prototype in CommandClassVersion.h.
+ * @brief Resets the chip.
  */
-BYTE
-handleNbrFirmwareVersions(void)
+PCB(ZCB_AppReset)(void)
 {
-  return 1; /*CHANGE THIS - firmware 0 version*/
+  APP_SOFT_RESET();
 }
 
 
 /**
- * @brief See description for function prototype in CommandClassVersion.h.
+ * @brief Reboots the node after pending work is done.
+ * @details Delayed NVM writes are started at once. Queued unsolicited
+ * frames are sent, for at most APP_REBOOT_DRAIN_TICKS. The crash record
+ * is then written with the reset cause and the chip reset when the write
+ * completes.
+ * @param resetCause CRASH_CAUSE_* stored in the crash record.
  */
-void
-handleGetFirmwareVersion(
-        BYTE bFirmwareNumber,
-        VG_VERSION_REPORT_V2_VG* pVariantgroup)
+static void
+AppReboot(BYTE resetCause)
 {
-  /*firmware 0 version and sub version*/
-	ZW_DEBUG_APP_SEND_STR("\nhandleGetFirmwareVersion()");
-	
-  if(bFirmwareNumber == 0)
+  ZW_DEBUG_APP_SEND_STR("\nAppReboot ");
+  ZW_DEBUG_APP_SEND_NUM(resetCause);
+
+  if (APP_REBOOT_NONE != rebootCause)
   {
-    pVariantgroup->firmwareVersion = APP_VERSION;
-    pVariantgroup->firmwareSubVersion = APP_REVISION;
+    return;
   }
-  else
+  rebootCause = resetCause;
+  if (APP_TIMER_NONE != groupcastHoldTimer)
   {
-    /*Just set it to 0 if firmware n is not present*/
-    pVariantgroup->firmwareVersion = 0;
-    pVariantgroup->firmwareSubVersion = 0;
+    ZW_TIMER_CANCEL(groupcastHoldTimer);
+    groupcastHoldTimer = APP_TIMER_NONE;
   }
+  /* Nothing is held any more, the update is over or abandoned */
+  otaActive = FALSE;
+  AppRequestSendNext();
+#ifdef APP_FEATURE_METER
+  /* Energy below METER_NVM_STEP is not marked dirty while running */
+  nvmDirty |= NVM_DIRTY_METER;
+#endif
+  NvmFlush();
+  rebootTimer = ZW_TIMER_START(ZCB_AppRebootDeadline, APP_REBOOT_DRAIN_TICKS, TIMER_ONE_TIME);
+  AppRebootCheck();
 }
 
 
 /**
- * Function return firmware Id of target n (0 => is device FW ID)
- * n read version of firmware number n (0,1..N-1)
- * @return firmaware ID.
+ * @brief Reboots if a reboot is requested and no unsolicited frame is in
+ * flight, waiting for the request buffer or queued.
  */
-WORD
-handleFirmWareIdGet( BYTE n)
+static void
+AppRebootCheck(void)
 {
-	ZW_DEBUG_APP_SEND_STR("\nhandleFirmWareIdGet()");
-	
-  if(n == 0)
+  if ((APP_REBOOT_NONE != rebootCause) && !AppRequestPending())
   {
-    return APP_FIRMWARE_ID;
+    AppRebootNow();
   }
-  else if (n == 1)
+}
+
+
+/**
+ * @brief Writes the crash record and resets when it is in NVM. Without
+ * APP_FEATURE_CRASH_RING the relay state is written instead, so the reset
+ * still waits for the writes NvmFlush() started.
+ */
+static void
+AppRebootNow(void)
+{
+  if (rebootStarted)
   {
-    return 0x1234;
+    return;
   }
-  return 0;
+  rebootStarted = TRUE;
+  if (APP_TIMER_NONE != rebootTimer)
+  {
+    ZW_TIMER_CANCEL(rebootTimer);
+    rebootTimer = APP_TIMER_NONE;
+  }
+#ifdef APP_FEATURE_CRASH_RING
+  CrashRingFlush(rebootCause, ZCB_AppReset);
+#else
+  if (!MemoryPutBuffer((WORD)&OnOffState_far, &relayLastState, 1, ZCB_AppReset))
+  {
+    ZCB_AppReset();
+  }
+#endif
 }
 
 
 /**
- * @brief See description for function prototype in CommandClassBianrySwitch.h
+ * @brief Reboots when pending work takes longer than allowed.
  */
-BYTE
-handleAppltBinarySwitchGet(BYTE endpoint)
+PCB(ZCB_AppRebootDeadline)(void)
 {
-	if(endpoint == 0) {
-		return s1_state_get();
-	}
-	else if(endpoint == 1) {
-		return s2_state_get();
-	}
-	else if(endpoint == 2) {
-		return s3_state_get();
-	}
-	return 0;
+  ZW_DEBUG_APP_SEND_STR("\nZCB_AppRebootDeadline");
+  rebootTimer = APP_TIMER_NONE;
+  AppRebootNow();
 }
 
 
+#ifdef APP_FEATURE_CRASH_RING
 /**
- * @brief See description for function prototype in CommandClassBianrySwitch.h
+ * @brief Builds a crash record page after the report header: reset cause,
+ * uptime in seconds, then the events oldest first as kind, value pairs.
+ * @param pData Start of the page data in the response buffer.
+ * @param pRecord Record to report.
+ * @return Number of data bytes written.
  */
-void
-handleApplBinarySwitchSet(CMD_CLASS_BIN_SW_VAL val, BYTE endpoint )
+static BYTE
+CrashRecordPageBuild(BYTE *pData, CRASH_RECORD *pRecord)
 {
-	if(endpoint == 0) {
-		s1_state_set(val);
-	}
-	else if(endpoint == 1) {
-		s2_state_set(val);
-	}
-	else if(endpoint == 2) {
-		s3_state_set(val);
-	}
+  BYTE *p = pData;
+  BYTE i;
+  BYTE index;
+
+  *p++ = pRecord->resetCause;
+  *p++ = (BYTE)(pRecord->uptime >> 24);
+  *p++ = (BYTE)(pRecord->uptime >> 16);
+  *p++ = (BYTE)(pRecord->uptime >> 8);
+  *p++ = (BYTE)pRecord->uptime;
+  for (i = 0; i < CRASH_RING_SIZE; i++)
+  {
+    index = (pRecord->head + i) & (CRASH_RING_SIZE - 1);
+    *p++ = pRecord->events[index].kind;
+    *p++ = pRecord->events[index].value;
+  }
+  return (BYTE)(p - pData);
 }
+#endif /* APP_FEATURE_CRASH_RING */
 
 
+#ifdef APP_FEATURE_LINK_STATS
 /**
- * @brief Sets the configuration to default values and saves it to EEPROM.
+ * @brief Returns the link statistics entry of a peer. A peer without an
+ * entry takes over the least active one. Only transmissions allocate
+ * entries, see LinkStatsRx().
+ * @param nodeId Peer node ID.
+ * @return Entry of the peer.
  */
-void
-SetDefaultConfiguration(void)
+static LINK_STATS_ENTRY *
+LinkStatsEntry(APP_NODE_ID nodeId)
 {
-	ZW_DEBUG_APP_SEND_STR("\nSetDefaultConfiguration()");
-	
-  onOffState = 0;
-  /* Mark stored configuration as OK */
-  MemoryPutByte((WORD)&OnOffState_far, onOffState);
-  MemoryPutByte((WORD)&EEOFFSET_MAGIC_far, APPL_MAGIC_VALUE);
-  MemoryPutByte( (WORD)&EEOFFSET_SWITCH_ALL_MODE_far[0],
-    SWITCH_ALL_REPORT_INCLUDED_IN_THE_ALL_ON_ALL_OFF_FUNCTIONALITY);
+  LINK_STATS_ENTRY *pVictim = &linkStats[0];
+  BYTE i;
+
+  for (i = 0; i < LINK_STATS_SIZE; i++)
+  {
+    if (linkStats[i].nodeId == nodeId)
+    {
+      return &linkStats[i];
+    }
+    if ((WORD)(linkStats[i].txCount + linkStats[i].rxCount) <
+        (WORD)(pVictim->txCount + pVictim->rxCount))
+    {
+      pVictim = &linkStats[i];
+    }
+  }
+  linkAlertPending &= ~(BYTE)(1 << (pVictim - linkStats));
+  memset((BYTE *)pVictim, 0, sizeof(LINK_STATS_ENTRY));
+  pVictim->nodeId = nodeId;
+  return pVictim;
 }
 
 
 /**
- * @brief Loads configuration from EEPROM. If no configuration is stored,
- * default values are loaded and then saved to EEPROM.
+ * @brief Counts the result of a transmission to a peer. A run of
+ * LINK_FAIL_ALERT failures pushes a link alert on the lifeline.
+ * @param nodeId Peer node ID.
+ * @param txStatus Transmit status from the protocol.
  */
-void
-LoadConfiguration(ZW_NVM_STATUS nvmStatus)
+static void
+LinkStatsTx(APP_NODE_ID nodeId, BYTE txStatus)
 {
-  uint8_t magicValue;
+  LINK_STATS_ENTRY *pEntry;
 
-	ZW_DEBUG_APP_SEND_STR("\nLoadConfiguration()");
-	
-  /* Get this sensors identification on the network */
-  MemoryGetID( NULL, &myNodeID);
-  ManufacturerSpecificDeviceIDInit();
-#ifdef BOOTLOADER_ENABLED
-  NvmInit(nvmStatus);
-#else
-  UNUSED(nvmStatus);
-#endif
-  /* Check to see, if any valid configuration is stored in the EEPROM */
-  magicValue = MemoryGetByte((WORD)&EEOFFSET_MAGIC_far);
-  ZW_DEBUG_APP_SEND_NL();
-  ZW_DEBUG_APP_SEND_BYTE('M');
-  ZW_DEBUG_APP_SEND_NUM(magicValue);
-  if (APPL_MAGIC_VALUE == magicValue)
+  if (0 == nodeId)
   {
-    loadStatusPowerLevel(NULL,NULL);
-    /* There is a configuration stored, so load it */
-    onOffState = MemoryGetByte((WORD)&OnOffState_far);
-    ZW_DEBUG_APP_SEND_NL();
-    ZW_DEBUG_APP_SEND_BYTE('C');
-    ZW_DEBUG_APP_SEND_BYTE('l');
-
-    AssociationInit(FALSE);
+    return;
   }
-  else
+  pEntry = LinkStatsEntry(nodeId);
+  pEntry->txCount++;
+  if (TRANSMIT_COMPLETE_OK == txStatus)
   {
-    ZW_MEM_PUT_BYTE((WORD)&EEOFFS_SECURITY_RESERVED.EEOFFS_MAGIC_BYTE_field, EEPROM_MAGIC_BYTE_VALUE);
-    /* Initialize transport layer NVM */
-    Transport_SetDefault();
-    /* Reset protocol */
-    ZW_SetDefault();
+    pEntry->failStreak = 0;
+    return;
+  }
+  pEntry->txFail++;
+  if (LINK_FAIL_ALERT == ++pEntry->failStreak)
+  {
+    linkAlertPending |= (BYTE)(1 << (pEntry - linkStats));
+  }
+}
 
-    /* Apparently there is no valid configuration in EEPROM, so load */
-    /* default values and save them to EEPROM. */
-    SetDefaultConfiguration();
 
-    /*Clear association*/
-    AssociationInit(TRUE);
+/**
+ * @brief Counts a frame received from a peer that already has an entry.
+ * @details Senders we never transmit to, such as broadcast sources, do not
+ * get an entry, so they cannot evict the peers whose transmissions the
+ * alerts are about.
+ * @param nodeId Source node ID.
+ */
+static void
+LinkStatsRx(APP_NODE_ID nodeId)
+{
+  BYTE i;
 
-    loadInitStatusPowerLevel(NULL, NULL);
+  for (i = 0; i < LINK_STATS_SIZE; i++)
+  {
+    if ((0 != nodeId) && (linkStats[i].nodeId == nodeId))
+    {
+      linkStats[i].rxCount++;
+      return;
+    }
   }
-  RefreshMMI();
 }
 
 
 /**
- * @brief Toggles LED state variable and refreshes MMI.
+ * @brief Writes link statistics entries: node ID, transmissions, failed
+ * transmissions, receptions and the current failure run.
+ * @param pData Destination in the report.
+ * @param first First entry.
+ * @param count Number of entries.
+ * @return Number of bytes written.
  */
-void
-ToggleLed(void)
+static BYTE
+LinkStatsPageBuild(BYTE *pData, BYTE first, BYTE count)
 {
-	ZW_DEBUG_APP_SEND_STR("\nToggleLed()");
-  /*if (onOffState)
-  {
-    onOffState = 0;
-  }
-  else
+  LINK_STATS_ENTRY *pEntry = &linkStats[first];
+  BYTE *p = pData;
+
+  for (; count; count--, pEntry++)
   {
-    onOffState = 0xff;
+    *p++ = pEntry->nodeId;
+    *p++ = (BYTE)(pEntry->txCount >> 8);
+    *p++ = (BYTE)pEntry->txCount;
+    *p++ = (BYTE)(pEntry->txFail >> 8);
+    *p++ = (BYTE)pEntry->txFail;
+    *p++ = (BYTE)(pEntry->rxCount >> 8);
+    *p++ = (BYTE)pEntry->rxCount;
+    *p++ = pEntry->failStreak;
   }
-  RefreshMMI();
-  MemoryPutByte((WORD)&OnOffState_far, onOffState);*/
+  return (BYTE)(p - pData);
 }
 
 
 /**
- * @brief Refreshes MMI.
+ * @brief Pushes the lowest pending link alert on the lifeline as an
+ * unsolicited link statistics page.
+ * @return TRUE if the request buffer is now in use, FALSE if nothing was
+ * started.
  */
-void
-RefreshMMI(void)
+static BOOL
+LinkAlertSendNext(void)
 {
-	ZW_DEBUG_APP_SEND_STR("\nRefreshMMI()");
-	
-  /*if (CMD_CLASS_BIN_OFF == onOffState)
+  ZW_APPLICATION_TX_BUFFER *pTxBuf;
+  BYTE *pFrame;
+  BYTE i;
+
+  for (i = 0; i < LINK_STATS_SIZE; i++)
   {
-    Led(ZDP03A_LED_D2,OFF);
+    if (0 == (linkAlertPending & (1 << i)))
+    {
+      continue;
+    }
+    pTxBuf = GetRequestBuffer(ZCB_AppRequestDone);
+    if (IS_NULL(pTxBuf))
+    {
+      appRequestBusy = TRUE;
+      return TRUE;
+    }
+    linkAlertPending &= ~(BYTE)(1 << i);
+    pFrame = (BYTE *)pTxBuf;
+    pFrame[0] = COMMAND_CLASS_MANUFACTURER_PROPRIETARY;
+    pFrame[1] = (BYTE)(APP_MANUFACTURER_ID >> 8);
+    pFrame[2] = (BYTE)APP_MANUFACTURER_ID;
+    pFrame[DIAG_OFFSET_CMD] = DIAG_CMD_REPORT;
+    pFrame[DIAG_OFFSET_PAGE] = DIAG_PAGE_LINK_ALERT;
+    if (JOB_STATUS_SUCCESS == ZW_TransportMulticast_SendRequest(
+                                pFrame,
+                                DIAG_OFFSET_DATA + LinkStatsPageBuild(&pFrame[DIAG_OFFSET_DATA], i, 1),
+                                FALSE,
+                                ReqNodeList(&lifelineProfile, &linkAlertCmdGrp, ENDPOINT_ROOT),
+                                ZCB_RequestJobStatus))
+    {
+      return TRUE;
+    }
+    /*No lifeline or transport failure, drop this alert*/
+    FreeRequestBuffer();
   }
-  else if (CMD_CLASS_BIN_ON == onOffState)
-  {
-    Led(ZDP03A_LED_D2,ON);
-  }*/
+  return FALSE;
 }
+#endif /* APP_FEATURE_LINK_STATS */
 
 
-/*
- * @brief Called when protocol needs to inform Application about a Security Event.
- * @details If the app does not need/want the Security Event the handling can be left empty.
- *
- *    Event E_APPLICATION_SECURITY_EVENT_S2_INCLUSION_REQUEST_DSK_CSA
- *          If CSA is needed, the app must do the following when this event occures:
- *             1. Obtain user input with first 4 bytes of the S2 including node DSK
- *             2. Store the user input in a response variable of type s_SecurityS2InclusionCSAPublicDSK_t.
- *             3. Call ZW_SetSecurityS2InclusionPublicDSK_CSA(response)
- *
+#ifdef APP_FEATURE_PROPRIETARY
+/**
+ * @brief Builds a Manufacturer Proprietary page after the report header.
+ * @param pData Start of the page data in the response buffer.
+ * @param page Requested page.
+ * @return Number of data bytes written, 0 if the page does not exist.
  */
-void
-ApplicationSecurityEvent(
-  s_application_security_event_data_t *securityEvent)
+static BYTE
+ProprietaryPageBuild(BYTE *pData, BYTE page)
 {
-	ZW_DEBUG_APP_SEND_STR("\nApplicationSecurityEvent()");
-  switch (securityEvent->event)
+#ifdef APP_FEATURE_LINK_STATS
+  if ((page >= DIAG_PAGE_LINK_FIRST) &&
+      (page < (DIAG_PAGE_LINK_FIRST + (LINK_STATS_SIZE / LINK_STATS_PER_PAGE))))
   {
-#ifdef APP_SUPPORTS_CLIENT_SIDE_AUTHENTICATION
-    case E_APPLICATION_SECURITY_EVENT_S2_INCLUSION_REQUEST_DSK_CSA:
-      {
-				ZW_DEBUG_APP_SEND_STR("\nE_APPLICATION_SECURITY_EVENT_S2_INCLUSION_REQUEST_DSK_CSA");
-        ZW_SetSecurityS2InclusionPublicDSK_CSA(&sCSAResponse);
-      }
-      break;
-#endif /* APP_SUPPORTS_CLIENT_SIDE_AUTHENTICATION */
+    return LinkStatsPageBuild(pData, (page - DIAG_PAGE_LINK_FIRST) * LINK_STATS_PER_PAGE,
+                              LINK_STATS_PER_PAGE);
+  }
+#endif
+#ifdef APP_FEATURE_CRASH_RING
+  switch (page)
+  {
+    case DIAG_PAGE_CRASH_PREVIOUS:
+      *pData = wakeupReason;
+      return 1 + CrashRecordPageBuild(pData + 1, &crashPrevious);
 
-    default:
-      break;
+    case DIAG_PAGE_CRASH_CURRENT:
+      return CrashRecordPageBuild(pData, &crashRecord);
   }
+#endif
+#ifdef APP_DIAGNOSTICS
+  return DiagPageBuild(pData, page);
+#else
+  UNUSED(pData);
+  UNUSED(page);
+  return 0;
+#endif
 }
 
 
 /**
-* Set up security keys to request when joining a network.
-* These are taken from the config_app.h header file.
-*/
-BYTE ApplicationSecureKeysRequested(void)
+ * @brief Handler for the Manufacturer Proprietary diagnostics command.
+ * @details Get returns one page of counters or a crash record, Reset clears
+ * all counters.
+ * Frames carrying another manufacturer ID are not supported. The pages
+ * tell what the node does and with whom, so only frames received on the
+ * highest security key granted to the node are answered.
+ * @param rxOpt Receive options.
+ * @param pCmd Received frame.
+ * @param cmdLength Length of the received frame.
+ * @return Frame status for the transport layer.
+ */
+received_frame_status_t
+handleCommandClassManufacturerProprietary(
+  RECEIVE_OPTIONS_TYPE_EX *rxOpt,
+  ZW_APPLICATION_TX_BUFFER *pCmd,
+  BYTE cmdLength)
 {
-	ZW_DEBUG_APP_SEND_STR("\nApplicationSecureKeysRequested()");
-  return REQUESTED_SECURITY_KEYS;
-}
+  BYTE *pFrame = (BYTE *)pCmd;
+  ZW_APPLICATION_TX_BUFFER *pTxBuf;
+  BYTE *pReport;
+  BYTE len;
 
-/**
-* Set up security S2 inclusion authentication to request when joining a network.
-* These are taken from the config_app.h header file.
-*/
-BYTE ApplicationSecureAuthenticationRequested(void)
-{
-	ZW_DEBUG_APP_SEND_STR("\nApplicationSecureAuthenticationRequested()");
-  return REQUESTED_SECURITY_AUTHENTICATION;
-}
+  ZW_DEBUG_APP_SEND_STR("\nhandleCommandClassManufacturerProprietary()");
+
+  if ((cmdLength <= DIAG_OFFSET_CMD) ||
+      (pFrame[1] != (BYTE)(APP_MANUFACTURER_ID >> 8)) ||
+      (pFrame[2] != (BYTE)APP_MANUFACTURER_ID))
+  {
+    return RECEIVED_FRAME_STATUS_NO_SUPPORT;
+  }
+  if (rxOpt->securityKey != GetHighestSecureLevel(ZW_GetSecurityKeys()))
+  {
+    return RECEIVED_FRAME_STATUS_FAIL;
+  }
 
+  switch (pFrame[DIAG_OFFSET_CMD])
+  {
+    case DIAG_CMD_GET:
+      if ((cmdLength <= DIAG_OFFSET_PAGE) || (TRUE == Check_not_legal_response_job(rxOpt)))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pTxBuf = GetResponseBuffer();
+      if (IS_NULL(pTxBuf))
+      {
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pReport = (BYTE *)pTxBuf;
+      len = ProprietaryPageBuild(&pReport[DIAG_OFFSET_DATA], pFrame[DIAG_OFFSET_PAGE]);
+      if (0 == len)
+      {
+        FreeResponseBuffer();
+        return RECEIVED_FRAME_STATUS_FAIL;
+      }
+      pReport[0] = COMMAND_CLASS_MANUFACTURER_PROPRIETARY;
+      pReport[1] = (BYTE)(APP_MANUFACTURER_ID >> 8);
+      pReport[2] = (BYTE)APP_MANUFACTURER_ID;
+      pReport[DIAG_OFFSET_CMD] = DIAG_CMD_REPORT;
+      pReport[DIAG_OFFSET_PAGE] = pFrame[DIAG_OFFSET_PAGE];
+      return SendAppResponse(rxOpt, pTxBuf, DIAG_OFFSET_DATA + len);
+
+#ifdef APP_DIAGNOSTICS
+    case DIAG_CMD_RESET:
+      memset((BYTE *)&diag, 0, sizeof(diag));
+      diag.windowStart = getTickTime();
+      return RECEIVED_FRAME_STATUS_SUCCESS;
+#endif
+  }
+  return RECEIVED_FRAME_STATUS_NO_SUPPORT;
+}
+#endif /* APP_FEATURE_PROPRIETARY */